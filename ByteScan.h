@@ -0,0 +1,226 @@
+#ifndef BYTE_SCAN_H
+#define BYTE_SCAN_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define BYTE_SCAN_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define BYTE_SCAN_NEON 1
+#endif
+
+// Vectorised counting and searching of a single byte value in a buffer,
+// e.g. newlines when counting lines or delimiters when splitting a file
+// into records. On x86-64 the AVX-512BW or AVX2 kernel is chosen at run time,
+// whichever the CPU supports, with a scalar fallback; on AArch64 NEON is
+// always there. Nothing needs special compiler flags.
+/* Example:
+   std::size_t szLines = ByteScan::count(data, size, '\n');
+   const std::uint8_t *pComma = ByteScan::find(data, size, ',');
+*/
+
+namespace ByteScan
+{
+
+  namespace detail
+  {
+    inline std::size_t countScalar(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      return static_cast<std::size_t>(std::count(p, p + size, byte));
+    }
+
+    inline const std::uint8_t *findScalar(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      auto pFound = static_cast<const std::uint8_t *>(std::memchr(p, byte, size));
+      return pFound ? pFound : p + size;
+    }
+
+    inline const std::uint8_t *findLastScalar(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      for (std::size_t i = size; i > 0; --i)
+        if (p[i - 1] == byte)
+          return p + i - 1;
+      return p + size;
+    }
+
+#if defined(BYTE_SCAN_X86)
+
+    __attribute__((target("avx2,popcnt"))) inline std::size_t countAvx2(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const __m256i vByte = _mm256_set1_epi8(static_cast<char>(byte));
+      std::size_t szCount = 0, i = 0;
+      for (; i + 128 <= size; i += 128)
+      {
+        const auto m0 = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)), vByte)));
+        const auto m1 = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + 32)), vByte)));
+        const auto m2 = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + 64)), vByte)));
+        const auto m3 = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i + 96)), vByte)));
+        szCount += static_cast<std::size_t>(_mm_popcnt_u64((std::uint64_t(m1) << 32) | m0) + _mm_popcnt_u64((std::uint64_t(m3) << 32) | m2));
+      }
+      for (; i + 32 <= size; i += 32)
+        szCount += static_cast<std::size_t>(_mm_popcnt_u32(static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)), vByte)))));
+      return szCount + countScalar(p + i, size - i, byte);
+    }
+
+    __attribute__((target("avx2"))) inline const std::uint8_t *findAvx2(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const __m256i vByte = _mm256_set1_epi8(static_cast<char>(byte));
+      std::size_t i = 0;
+      for (; i + 32 <= size; i += 32)
+        if (auto uMask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i)), vByte))))
+          return p + i + __builtin_ctz(uMask);
+      return findScalar(p + i, size - i, byte);
+    }
+
+    __attribute__((target("avx2"))) inline const std::uint8_t *findLastAvx2(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const __m256i vByte = _mm256_set1_epi8(static_cast<char>(byte));
+      std::size_t i = size;
+      for (; i >= 32; i -= 32)
+        if (auto uMask = static_cast<std::uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(p + i - 32)), vByte))))
+          return p + i - 1 - __builtin_clz(uMask);
+      const std::uint8_t *pFound = findLastScalar(p, i, byte);
+      return pFound == p + i ? p + size : pFound;
+    }
+
+    __attribute__((target("avx512bw,popcnt"))) inline std::size_t countAvx512(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const __m512i vByte = _mm512_set1_epi8(static_cast<char>(byte));
+      std::size_t szCount = 0, i = 0;
+      for (; i + 256 <= size; i += 256)
+        szCount += static_cast<std::size_t>(
+            _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + i), vByte)) +
+            _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + i + 64), vByte)) +
+            _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + i + 128), vByte)) +
+            _mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + i + 192), vByte)));
+      for (; i + 64 <= size; i += 64)
+        szCount += static_cast<std::size_t>(_mm_popcnt_u64(_mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + i), vByte)));
+      if (i < size)
+      {
+        // The tail is read with a masked load, which does not fault past the end
+        const __mmask64 uTail = ~std::uint64_t(0) >> (64 - (size - i));
+        szCount += static_cast<std::size_t>(_mm_popcnt_u64(_mm512_mask_cmpeq_epi8_mask(uTail, _mm512_maskz_loadu_epi8(uTail, p + i), vByte)));
+      }
+      return szCount;
+    }
+
+    __attribute__((target("avx512bw"))) inline const std::uint8_t *findAvx512(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const __m512i vByte = _mm512_set1_epi8(static_cast<char>(byte));
+      for (std::size_t i = 0; i < size; i += 64)
+      {
+        const __mmask64 uValid = size - i >= 64 ? ~std::uint64_t(0) : ~std::uint64_t(0) >> (64 - (size - i));
+        if (std::uint64_t uMask = _mm512_mask_cmpeq_epi8_mask(uValid, _mm512_maskz_loadu_epi8(uValid, p + i), vByte))
+          return p + i + __builtin_ctzll(uMask);
+      }
+      return p + size;
+    }
+
+#elif defined(BYTE_SCAN_NEON)
+
+    inline std::size_t countNeon(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const uint8x16_t vByte = vdupq_n_u8(byte);
+      std::size_t szCount = 0, i = 0;
+      while (i + 16 <= size)
+      {
+        // Byte lanes count up to 255 matches before they are widened
+        uint8x16_t vAcc = vdupq_n_u8(0);
+        const std::size_t szEnd = std::min(size - 15, i + 255 * 16);
+        for (; i < szEnd; i += 16)
+          vAcc = vsubq_u8(vAcc, vceqq_u8(vld1q_u8(p + i), vByte));
+        szCount += vaddlvq_u8(vAcc);
+      }
+      return szCount + countScalar(p + i, size - i, byte);
+    }
+
+    // 4 bits per byte of the comparison, as a 64-bit mask
+    inline std::uint64_t nibbleMask(uint8x16_t vEq) noexcept
+    {
+      return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(vEq), 4)), 0);
+    }
+
+    inline const std::uint8_t *findNeon(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const uint8x16_t vByte = vdupq_n_u8(byte);
+      std::size_t i = 0;
+      for (; i + 16 <= size; i += 16)
+        if (std::uint64_t uMask = nibbleMask(vceqq_u8(vld1q_u8(p + i), vByte)))
+          return p + i + (__builtin_ctzll(uMask) >> 2);
+      return findScalar(p + i, size - i, byte);
+    }
+
+    inline const std::uint8_t *findLastNeon(const std::uint8_t *p, std::size_t size, std::uint8_t byte) noexcept
+    {
+      const uint8x16_t vByte = vdupq_n_u8(byte);
+      std::size_t i = size;
+      for (; i >= 16; i -= 16)
+        if (std::uint64_t uMask = nibbleMask(vceqq_u8(vld1q_u8(p + i - 16), vByte)))
+          return p + i - 1 - (__builtin_clzll(uMask) >> 2);
+      const std::uint8_t *pFound = findLastScalar(p, i, byte);
+      return pFound == p + i ? p + size : pFound;
+    }
+
+#endif
+
+    struct Kernels
+    {
+      std::size_t (*count)(const std::uint8_t *, std::size_t, std::uint8_t) noexcept;
+      const std::uint8_t *(*find)(const std::uint8_t *, std::size_t, std::uint8_t) noexcept;
+      const std::uint8_t *(*findLast)(const std::uint8_t *, std::size_t, std::uint8_t) noexcept;
+      const char *name;
+    };
+
+    // Picked once, on first use
+    inline const Kernels &kernels() noexcept
+    {
+      static const Kernels kernels = [] {
+#if defined(BYTE_SCAN_X86)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+          return Kernels{countAvx512, findAvx512, findLastAvx2, "avx512bw"};
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+          return Kernels{countAvx2, findAvx2, findLastAvx2, "avx2"};
+        return Kernels{countScalar, findScalar, findLastScalar, "scalar"};
+#elif defined(BYTE_SCAN_NEON)
+        return Kernels{countNeon, findNeon, findLastNeon, "neon"};
+#else
+        return Kernels{countScalar, findScalar, findLastScalar, "scalar"};
+#endif
+      }();
+      return kernels;
+    }
+  }
+
+  // Number of bytes equal to byte in [data, data + size)
+  inline std::size_t count(const void *data, std::size_t size, std::uint8_t byte) noexcept
+  {
+    return detail::kernels().count(static_cast<const std::uint8_t *>(data), size, byte);
+  }
+
+  // First byte equal to byte in [data, data + size), or data + size
+  inline const std::uint8_t *find(const void *data, std::size_t size, std::uint8_t byte) noexcept
+  {
+    return detail::kernels().find(static_cast<const std::uint8_t *>(data), size, byte);
+  }
+
+  // Last byte equal to byte in [data, data + size), or data + size
+  inline const std::uint8_t *findLast(const void *data, std::size_t size, std::uint8_t byte) noexcept
+  {
+    return detail::kernels().findLast(static_cast<const std::uint8_t *>(data), size, byte);
+  }
+
+  // Name of the kernel in use: "avx512bw", "avx2", "neon" or "scalar"
+  inline const char *kernelName() noexcept
+  {
+    return detail::kernels().name;
+  }
+
+} // namespace ByteScan
+
+#endif // BYTE_SCAN_H
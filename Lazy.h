@@ -1,11 +1,16 @@
 #ifndef LAZY_H
 #define LAZY_H
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <condition_variable>
+#include <cstdint>
+#include <deque>
 #include <exception>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <thread>
 #include <tuple>
 #include <type_traits>
@@ -14,6 +19,9 @@
 #include <vector>
 #include <initializer_list>
 
+#include "SchedStats.h"
+#include "Topology.h"
+
 // A library for running functions in parallel
 // using future-like objects with continuation
 // and lazy evaluation.
@@ -202,14 +210,336 @@ namespace Lazy
     return false;
   }
 
+  // A persistent set of worker threads sharing one FIFO job queue.
+  // Futures can be run on a pool (see StateFuture::run(Executor&))
+  // instead of getting a new thread of their own, and runForAll can use
+  // the workers for its parallel loops (see forkJoin).
+  // Idle workers are parked on an atomic signal word (futex-style
+  // std::atomic::wait), which is bumped whenever there is new work.
+  // Note: a job must not block waiting for another job of the same pool,
+  // otherwise all the workers may end up waiting for jobs nobody runs.
+  class Pool
+  {
+  public:
+    explicit Pool(std::size_t numThreads = Topology::cpuCount())
+        : Pool(Topology::Placement(numThreads))
+    {
+    }
+
+    // One worker per slot of the placement, pinned to its CPU, if any.
+    explicit Pool(const Topology::Placement &placement)
+        : _stats(placement.size())
+    {
+      _threads.resize(placement.size());
+      for (std::size_t i = 0; i < _threads.size(); ++i)
+        _threads[i] = std::thread([this, i, slot = placement[i]]() {
+          slot.apply();
+          work(i);
+        });
+    }
+
+    Pool(const Pool &) = delete;
+    Pool &operator=(const Pool &) = delete;
+
+    // Runs the jobs already in the queue and joins the workers.
+    ~Pool()
+    {
+      _stop.store(true);
+      wakeUp(true);
+      for (auto &thr : _threads)
+        joinThread(&thr);
+    }
+
+    // Queues a nullary function to be run by one of the workers.
+    // The function may be move-only.
+    template <class F>
+    void post(F &&f)
+    {
+      auto job = std::make_unique<Job<std::decay_t<F>>>(std::forward<F>(f));
+      job->queued = _stats.enqueued();
+      {
+        std::unique_lock lck(_mtx);
+        _jobs.push_back(std::move(job));
+      }
+      wakeUp(false);
+    }
+
+    // Runs worker(iThread, numThreads) for iThread = 0...numThreads-1 using the
+    // calling thread and the parked workers, and returns when all of them
+    // are done. The calling thread takes part, so the call never waits
+    // for a worker busy with a posted job to pick up a share.
+    // Concurrent calls are serialized. If called from one of the workers,
+    // or from a share the calling thread of another forkJoin runs itself
+    // (nested parallelism), the shares are run in the calling thread.
+    // The worker must not throw.
+    template <class Worker>
+    void forkJoin(std::size_t numThreads, Worker &worker)
+    {
+      if (numThreads <= 1 || _pCurrent == this)
+      {
+        for (std::size_t i = 0; i < numThreads; ++i)
+          worker(i, numThreads);
+        return;
+      }
+
+      std::unique_lock lck(_forkMtx);
+      // While it holds the fork, the calling thread counts as one of ours,
+      // so a share it runs which forks again runs inline rather than
+      // locking _forkMtx a second time
+      struct CurrentScope
+      {
+        Pool *pPrevious;
+        ~CurrentScope() { _pCurrent = pPrevious; }
+      } scope{std::exchange(_pCurrent, this)};
+      _pForkContext = &worker;
+      _pForkFunction = [](void *pContext, std::size_t iThread, std::size_t n) {
+        (*static_cast<Worker *>(pContext))(iThread, n);
+      };
+      _forkPending.store(numThreads);
+      // Publishing the slot word opens the shares for the workers.
+      _forkSlots.store(std::uint64_t(numThreads) << 32);
+      wakeUp(true);
+
+      std::size_t iThread;
+      while (claimShare(iThread))
+        runShare(iThread);
+
+      // Wait for the shares picked up by the workers. Spin first, they are
+      // usually about to finish.
+      for (int i = 0; i < 64; ++i)
+      {
+        if (_forkPending.load() == 0)
+          return;
+        std::this_thread::yield();
+      }
+      for (auto n = _forkPending.load(); n != 0; n = _forkPending.load())
+        _forkPending.wait(n);
+    }
+
+    std::size_t size() const noexcept
+    {
+      return _threads.size();
+    }
+
+    // Counters of the posted jobs and the workers, see SchedStats.h. Shares
+    // of forkJoin count towards a worker's busy time but not as tasks.
+    // Empty unless built with SCHED_STATS.
+    SchedStats::Snapshot stats() const
+    {
+      return _stats.snapshot();
+    }
+
+  private:
+    struct JobBase
+    {
+      virtual ~JobBase() = default;
+      virtual void run() = 0;
+      [[no_unique_address]] SchedStats::Stamp queued;
+    };
+
+    template <class F>
+    struct Job : JobBase
+    {
+      F f;
+      explicit Job(F &&fun) : f(std::move(fun)) {}
+      explicit Job(const F &fun) : f(fun) {}
+      void run() override { f(); }
+    };
+
+    void wakeUp(bool bAll)
+    {
+      _stats.wokeUp();
+      _signal.fetch_add(1);
+      if (bAll)
+        _signal.notify_all();
+      else
+        _signal.notify_one();
+    }
+
+    std::unique_ptr<JobBase> popJob()
+    {
+      std::unique_lock lck(_mtx);
+      if (_jobs.empty())
+        return nullptr;
+      auto job = std::move(_jobs.front());
+      _jobs.pop_front();
+      return job;
+    }
+
+    // _forkSlots holds the number of shares in the upper and the next
+    // unclaimed share in the lower 32 bits. Claiming with a CAS on the whole
+    // word means a worker holding a stale value can never take a share of
+    // the next forkJoin call.
+    bool claimShare(std::size_t &iThread)
+    {
+      auto uSlots = _forkSlots.load();
+      while ((uSlots & 0xffffffff) < (uSlots >> 32))
+      {
+        if (_forkSlots.compare_exchange_weak(uSlots, uSlots + 1))
+        {
+          iThread = uSlots & 0xffffffff;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    void runShare(std::size_t iThread)
+    {
+      _pForkFunction(_pForkContext, iThread, std::size_t(_forkSlots.load() >> 32));
+      if (_forkPending.fetch_sub(1) == 1)
+        _forkPending.notify_one();
+    }
+
+    void work(std::size_t index)
+    {
+      _pCurrent = this;
+      auto &stats = _stats.worker(index);
+      while (true)
+      {
+        auto uSignal = _signal.load();
+        std::size_t iThread;
+        if (claimShare(iThread))
+        {
+          const auto start = SchedStats::now();
+          runShare(iThread);
+          stats.finished(start);
+        }
+        else if (auto job = popJob())
+        {
+          const auto start = stats.started(job->queued);
+          job->run();
+          stats.finished(start);
+        }
+        else if (_stop.load())
+          return; // Nothing is left to do
+        else
+        {
+          const auto parked = stats.parking();
+          _signal.wait(uSignal);
+          stats.unparked(parked);
+        }
+      }
+    }
+
+    std::mutex _mtx;
+    std::deque<std::unique_ptr<JobBase>> _jobs;
+    std::atomic_bool _stop{false};
+    alignas(64) std::atomic<std::uint32_t> _signal{0};
+
+    std::mutex _forkMtx; // One forkJoin at a time
+    void (*_pForkFunction)(void *, std::size_t, std::size_t) = nullptr;
+    void *_pForkContext = nullptr;
+    alignas(64) std::atomic<std::uint64_t> _forkSlots{0};
+    alignas(64) std::atomic_size_t _forkPending{0};
+
+    std::vector<std::thread> _threads;
+    [[no_unique_address]] SchedStats::Stats _stats;
+    static inline thread_local Pool *_pCurrent = nullptr; // Pool of the calling worker
+  };
+
+  // Pool shared by everyone who doesn't want to manage a pool of their own.
+  // Created at first use with one worker per CPU the process may use.
+  inline Pool &sharedPool()
+  {
+    static Pool pool;
+    return pool;
+  }
+
+  // Launchers decide where the ".then"-chain of a future is run.
+  // A launcher takes a nullary function and returns the thread it runs on,
+  // or a default constructed (non-joinable) std::thread if the function
+  // runs on a thread owned by someone else.
+
+  // Runs the chain in a new thread of its own.
+  struct NewThread
+  {
+    template <class F>
+    std::thread operator()(F &&f) const
+    {
+      return std::thread(std::forward<F>(f));
+    }
+  };
+
+  // Posts the chain to an executor, i.e. to anything with post(f).
+  template <class Executor>
+  struct OnExecutor
+  {
+    Executor *pExecutor;
+
+    template <class F>
+    std::thread operator()(F &&f) const
+    {
+      pExecutor->post(std::forward<F>(f));
+      return std::thread();
+    }
+  };
+
   // Non-movable, non-copyable part of SyncState (see below).
   // Unlike SyncState, it does not depend on return type T.
+  // thr is joinable only if the future was run in a thread of its own.
+  // If it was run on an executor, the core only tracks completion.
+  //
+  // Completion is signalled through the atomic status word:
+  // Empty -> (Waiting ->) Ready -> Done. The setter stores the result,
+  // moves the status to Ready, wakes a parked waiter if there is one, and
+  // finally stores Done. The waiter returns only after seeing Done, so the
+  // setter never touches a core which the waiter has already destroyed.
   struct SyncCore
   {
-    std::mutex mtx;
-    std::condition_variable cv;
+    enum Status : int
+    {
+      Empty,   // No result yet, nobody waiting
+      Waiting, // No result yet, a waiter is (about to be) parked
+      Ready,   // The result is stored, the setter is about to store Done
+      Done     // The result is stored and the setter has let go of the core
+    };
+
+    std::atomic<int> status{Empty};
     std::thread thr;
     ~SyncCore() { joinThread(&thr); }
+
+    bool isDone() const noexcept
+    {
+      return status.load(std::memory_order_acquire) == Done;
+    }
+
+    // Called by the setter after the result has been stored.
+    void complete() noexcept
+    {
+      if (status.exchange(Ready, std::memory_order_acq_rel) == Waiting)
+        status.notify_all();
+      status.store(Done, std::memory_order_release);
+    }
+
+    // Spins for a while, then parks until complete() has been called.
+    void wait() noexcept
+    {
+      for (int i = 0; i < SpinCount; ++i)
+      {
+        if (isDone())
+          return;
+        std::this_thread::yield();
+      }
+      int s = status.load(std::memory_order_acquire);
+      while (s != Done)
+      {
+        if (s == Empty)
+          status.compare_exchange_weak(s, Waiting, std::memory_order_acq_rel);
+        else if (s == Waiting)
+        {
+          status.wait(Waiting, std::memory_order_acquire);
+          s = status.load(std::memory_order_acquire);
+        }
+        else
+        { // Ready: the setter is on its last instructions
+          std::this_thread::yield();
+          s = status.load(std::memory_order_acquire);
+        }
+      }
+    }
+
+    static constexpr int SpinCount = 64;
   };
 
   // State for holding the result of type T or an exception.
@@ -234,6 +564,7 @@ namespace Lazy
   // the result of a task and notifies to whom it
   // may concern that either the result is ready or
   // an exception has been thrown.
+  // No lock is taken: the result is published through SyncCore::status.
   // SyncPromise is a concrete object which does not
   // depend on any lower level promises.
   template <class T, class CallBack>
@@ -258,10 +589,9 @@ namespace Lazy
     template <int I, class... V>
     void _set(const V &...vs)
     {
-      std::unique_lock lck(pst->core->mtx);
       pst->data.template emplace<I>(vs...);
-      lck.unlock();
-      pst->core->cv.notify_one();
+      // After this, pst may be gone.
+      pst->core->complete();
       // Callback to notify that the work is done
       // and the result is available for Future::get().
       if (pValueIsSet != nullptr)
@@ -271,9 +601,10 @@ namespace Lazy
     }
   };
 
-  // Returns a lambda which inputs a promise-like
-  // object p and creates a thread which sets a value to the promise.
-  // The lambda returns the thread.
+  // Returns a lambda which inputs a promise-like object p and a launcher
+  // (see NewThread and OnExecutor) and uses the launcher to run a function
+  // which sets a value to the promise. The lambda returns the thread
+  // returned by the launcher.
   // Note that the parameter u the only copy made of the input.
   // From now on, u will be moved, not copied.
   // This function will be used to initialize the ".then"-chain
@@ -281,8 +612,8 @@ namespace Lazy
   template <class U>
   auto makeNewThread(U u)
   {
-    return [uu = std::move(u)](auto p) -> std::thread {
-      std::thread t{[p = std::move(p), &uu]() mutable {
+    return [uu = std::move(u)](auto p, auto launch) -> std::thread {
+      return launch([p = std::move(p), &uu]() mutable {
         try
         {
           p.set_value(uu);
@@ -294,8 +625,7 @@ namespace Lazy
           // will be destroyed when the pointer eventually goes out of scope.
           p.set_exception(std::current_exception());
         }
-      }};
-      return t;
+      });
     };
   }
 
@@ -303,8 +633,8 @@ namespace Lazy
   template <class U1, class U2>
   auto makeNewThread(U1 u1, U2 u2)
   {
-    return [uu1 = std::move(u1), uu2 = std::move(u2)](auto p) -> std::thread {
-      std::thread t{[p = std::move(p), &uu1, &uu2]() mutable {
+    return [uu1 = std::move(u1), uu2 = std::move(u2)](auto p, auto launch) -> std::thread {
+      return launch([p = std::move(p), &uu1, &uu2]() mutable {
         try
         {
           p.set_value(uu1, uu2);
@@ -313,8 +643,7 @@ namespace Lazy
         {
           p.set_exception(std::current_exception());
         }
-      }};
-      return t;
+      });
     };
   }
 
@@ -324,8 +653,8 @@ namespace Lazy
   template <class... U>
   auto makeNewThread(const U &...u)
   {
-    return [u...](auto p) -> std::thread { // Note: [u...] makes a copy!
-      std::thread t{[p = std::move(p), &u...]() mutable {
+    return [u...](auto p, auto launch) -> std::thread { // Note: [u...] makes a copy!
+      return launch([p = std::move(p), &u...]() mutable {
         try
         {
           p.set_value(u...);
@@ -334,8 +663,7 @@ namespace Lazy
         {
           p.set_exception(std::current_exception());
         }
-      }};
-      return t;
+      });
     };
   }
 
@@ -362,6 +690,12 @@ namespace Lazy
   // ... do stuff while the future is running ...
   double result = fut.get(futRun);
 */
+  // Instead of a thread of its own, the chain can also be run on a pool:
+  /*
+  auto futRun = fut.run(Lazy::sharedPool());
+*/
+  // fut.is_ready(futRun) and fut.try_get(futRun) check for the result
+  // without blocking.
   // Note! A Future should be instantiated only by calling function
   // future(...) as shown in the example.
   template <class Task, class T, class... U>
@@ -374,8 +708,9 @@ namespace Lazy
     // Otherwise the thread will not be created for ".then"- function chain.
     explicit Future(const U &...u) : _task(makeNewThread(u...)){};
 
-    // Task must be a function which inputs a promise-like
-    // object p and returns an std::thread (which calls p.set_value).
+    // Task must be a function which inputs a promise-like object p and
+    // a launcher, and returns the std::thread returned by the launcher
+    // (which runs a function calling p.set_value).
     Future(Task &&task) : _task(std::forward<Task>(task)){};
 
     // Makes a new Future from *this. The new future is otherwise
@@ -392,8 +727,8 @@ namespace Lazy
       // promise with a new promise.
       // The return type of f is the return type of _task, which is std::thread.
       // At the top level p will be a SyncPromise (called from run())
-      auto f = [task = std::move(_task), funcCapture = std::move(func)](auto prom) {
-        return task(Promise(prom, std::move(funcCapture)));
+      auto f = [task = std::move(_task), funcCapture = std::move(func)](auto prom, auto launch) {
+        return task(Promise(prom, std::move(funcCapture)), launch);
       };
       // Return a new future with the new promise associated to the input parameter
       // of the task.
@@ -418,17 +753,38 @@ namespace Lazy
       return StateFutureWithCore<Task, T, U...>(std::move(_task));
     }
 
+    // Waits for the task to finish, i.e. for something (the result or
+    // an exception) to be stored in the state data.
+    void wait(SyncState<T> *state) const
+    {
+      state->core->wait();
+      joinThread(&state->core->thr); // Not joinable if run on an executor
+    }
+
+    // Returns true if the result (or an exception) is available,
+    // i.e. get() would not block. Never blocks.
+    bool is_ready(const SyncState<T> *state) const noexcept
+    {
+      return state->core->isDone();
+    }
+
+    // Returns the result if it is available, otherwise an empty optional.
+    // Rethrows the exception of the task if there was one.
+    // Does not wait for the task (if run in a thread of its own, the thread
+    // is joined, but it has nothing left to do at that point).
+    std::optional<T> try_get(SyncState<T> *state) const
+    {
+      if (!is_ready(state))
+        return std::nullopt;
+      return get(state);
+    }
+
     // Gets the result of the future by waiting for the result to appear
     // in the state data.
     T get(SyncState<T> *state) const
     {
-      { // Wait for the task to finish.
-        // It is finished when something (the result or an exception) has been
-        // stored in the state data.
-        std::unique_lock lck(state->core->mtx);
-        state->core->cv.wait(lck, [state]() { return state->data.index() != 0; });
-      }
-      state->core->thr.join();
+      wait(state);
+
       // Throw or return the result
       if (state->data.index() == 1)
         std::rethrow_exception(std::get<1>(state->data));
@@ -436,10 +792,11 @@ namespace Lazy
     }
 
   protected:
-    // Task is a lambda function that takes a promise-like object p as
-    // the parameter and returns another lambda function which takes
-    // another promise-like object. The return value of the task is
-    // the thread that the task is running on.
+    // Task is a lambda function that takes a promise-like object p and
+    // a launcher as the parameters and returns another lambda function which
+    // takes another promise-like object. The return value of the task is
+    // the thread that the task is running on (non-joinable if it is not
+    // running on a thread of its own).
     Task _task;
   }; // Future
 
@@ -463,7 +820,19 @@ namespace Lazy
     template <class CallBack = Empty>
     SyncState<T> *run(CallBack *callBack = nullptr)
     {
-      _state.core->thr = this->_task(SyncPromise<T, CallBack>{&_state, callBack}); // Launch task
+      _state.core->status.store(SyncCore::Empty);
+      _state.core->thr = this->_task(SyncPromise<T, CallBack>{&_state, callBack}, NewThread{}); // Launch task
+      return &_state;
+    }
+
+    // Same as above but the chain is posted to the given executor
+    // (e.g. Lazy::Pool) instead of being run in a new thread.
+    // The executor must outlive the call to get().
+    template <class Executor, class CallBack = Empty>
+    SyncState<T> *run(Executor &executor, CallBack *callBack = nullptr)
+    {
+      _state.core->status.store(SyncCore::Empty);
+      this->_task(SyncPromise<T, CallBack>{&_state, callBack}, OnExecutor<Executor>{&executor});
       return &_state;
     }
 
@@ -508,39 +877,110 @@ namespace Lazy
     return std::make_tuple(std::get<I>(futs).get(std::get<I>(states))...);
   }
 
-  // Executes the given futures in parallel and returns the values of as a tuple
+  // Thrown instead of running a task which was skipped because an other
+  // task of the same batch failed or the stop token was set.
+  struct Cancelled : std::exception
+  {
+    const char *what() const noexcept override
+    {
+      return "Lazy: task cancelled";
+    }
+  };
+
+  // Shared by the tasks of one runParallel (or array runForAll) call.
+  // Once a task has thrown or the token has been set, the tasks which have
+  // not started yet throw Cancelled instead of running.
+  // The first exception is kept, so that it can be rethrown instead of
+  // a Cancelled from a task which happens to come earlier in the batch.
+  struct CancelScope
+  {
+    StopToken *pToken = nullptr;
+    std::atomic_size_t szExceptionCount{0};
+    std::exception_ptr pException;
+
+    CancelScope() = default;
+    explicit CancelScope(StopToken *pTok) noexcept : pToken(pTok) {}
+
+    bool cancelled() const noexcept
+    {
+      return szExceptionCount.load(std::memory_order_relaxed) > 0 || (pToken && *pToken);
+    }
+
+    // Returns func wrapped into the cancellation checks. func must outlive the wrapper.
+    template <class Func>
+    auto wrap(Func &func)
+    {
+      return [this, &func](const auto &...xs) -> decltype(func(xs...)) {
+        if (cancelled())
+          throw Cancelled();
+        try
+        {
+          return func(xs...);
+        }
+        catch (...)
+        {
+          if (szExceptionCount.fetch_add(1) == 0)
+          {
+            pException = std::current_exception();
+            if (pToken)
+              pToken->setValue(1); // Let the running tasks know
+          }
+          throw;
+        }
+      };
+    }
+
+    // Rethrows the first exception, if there was one.
+    void rethrow() const
+    {
+      if (pException)
+        std::rethrow_exception(pException);
+    }
+  };
+
+  // Runs a finalized future either in a thread of its own (pPool == nullptr)
+  // or on the given pool.
+  template <class Fut>
+  auto runOn(Pool *pPool, Fut &fut)
+  {
+    return pPool ? fut.run(*pPool) : fut.run();
+  }
+
+  // Executes the given futures in parallel on the given pool (or in threads
+  // of their own if pPool is nullptr) and returns the values of as a tuple
   template <class... Futs>
-  auto runFutures(Futs &&...fs)
+  auto runFuturesOn(Pool *pPool, Futs &&...fs)
   {
     auto futures = std::make_tuple(fs...);
-    auto states = std::make_tuple(fs.run()...);
+    // Braced initialization launches the futures in order (left to right).
+    auto states = std::apply([pPool](auto &...f) { return std::tuple{runOn(pPool, f)...}; }, futures);
+    // Wait for all of them before getting any, because get() may throw,
+    // and the others must not be left running with their states going away.
+    std::apply([&states](auto &...f) { std::apply([&f...](auto... st) { (f.wait(st), ...); }, states); }, futures);
     return getResults(futures, states, std::make_index_sequence<sizeof...(Futs)>{});
   }
 
+  // Executes the given futures in parallel and returns the values of as a tuple
+  template <class... Futs>
+  auto runFutures(Futs &&...fs)
+  {
+    return runFuturesOn(nullptr, std::forward<Futs>(fs)...);
+  }
+
   // Helper function for sorting out the index sequence for the tuple of futures.
   template <class FutTuple, std::size_t... I>
-  auto runParallelAsTuple(FutTuple &&futs, std::index_sequence<I...>)
+  auto runParallelAsTuple(Pool *pPool, FutTuple &&futs, std::index_sequence<I...>)
   {
     static_assert(std::tuple_size_v<FutTuple> == sizeof...(I), "Index sequence doesn't match.");
     // Stack-allocated set of core structures. One for each function.
     std::array<SyncCore, std::tuple_size_v<FutTuple>> aCore;
-    return runFutures(std::get<I>(futs).finalize(&aCore[I])...);
+    return runFuturesOn(pPool, std::get<I>(futs).finalize(&aCore[I])...);
   }
 
-  // Runs the given functions in parallel in a future and returns the values as a
-  // tuple. The functions either must take no parameters or take StopToken* as the
-  // only parameter.
-  // The functions which take more parameters can be wrapped to a lambda.
-  // The parameters can be places into the capture list of the lambda.
-  // Example:
-  /*
-  double myFunc(int x, int y) { return std::sqrt(x * y); }
-  auto [res_dbl, res_int] =
-    Lazy::runParallel([x = 10, y = 15](){ return myFunc(x, y); },
-                      [x = 10, y = 20](){ return int(myFunc(x, y)); });
-*/
+  // Runs the given functions on pool pPool (or in threads of their own
+  // if pPool is nullptr). See runParallel below.
   template <class... Funcs>
-  auto runParallel(Funcs &&...funcs)
+  auto runParallelOn(Pool *pPool, Funcs &&...funcs)
   {
     // The functions take stop token as the only parameter
     constexpr bool bParamStopToken = (std::is_invocable<Funcs, StopToken *>() && ...);
@@ -550,13 +990,35 @@ namespace Lazy
     if constexpr (bParamStopToken)
     {
       StopToken token;
-      return runParallelAsTuple(std::make_tuple(future<decltype(funcs(std::declval<StopToken *>()))>(&token).then(
-                                    std::forward<Funcs>(funcs))...),
-                                std::make_index_sequence<sizeof...(Funcs)>{});
+      CancelScope scope{&token};
+      try
+      {
+        return runParallelAsTuple(pPool,
+                                  std::make_tuple(future<decltype(funcs(std::declval<StopToken *>()))>(&token).then(
+                                      scope.wrap(funcs))...),
+                                  std::make_index_sequence<sizeof...(Funcs)>{});
+      }
+      catch (...)
+      {
+        scope.rethrow();
+        throw;
+      }
     }
     else if constexpr (bParamNone)
-      return runParallelAsTuple(std::make_tuple(future<decltype(funcs())>().then(std::forward<Funcs>(funcs))...),
-                                std::make_index_sequence<sizeof...(Funcs)>{});
+    {
+      CancelScope scope;
+      try
+      {
+        return runParallelAsTuple(pPool,
+                                  std::make_tuple(future<decltype(funcs())>().then(scope.wrap(funcs))...),
+                                  std::make_index_sequence<sizeof...(Funcs)>{});
+      }
+      catch (...)
+      {
+        scope.rethrow();
+        throw;
+      }
+    }
     else
     {
       static_assert(bParamStopToken || bParamNone,
@@ -565,6 +1027,40 @@ namespace Lazy
     }
   }
 
+  // Runs the given functions in parallel in a future and returns the values as a
+  // tuple. The functions either must take no parameters or take StopToken* as the
+  // only parameter.
+  // If a function throws, the functions which have not started yet are
+  // skipped, the token (if any) is set so that the running ones can stop
+  // early, and the first exception is rethrown. Setting the token from
+  // a function skips the unstarted ones too.
+  // The functions which take more parameters can be wrapped to a lambda.
+  // The parameters can be places into the capture list of the lambda.
+  // Example:
+  /*
+  double myFunc(int x, int y) { return std::sqrt(x * y); }
+  auto [res_dbl, res_int] =
+    Lazy::runParallel([x = 10, y = 15](){ return myFunc(x, y); },
+                      [x = 10, y = 20](){ return int(myFunc(x, y)); });
+*/
+  template <class... Funcs>
+  auto runParallel(Funcs &&...funcs)
+  {
+    return runParallelOn(nullptr, std::forward<Funcs>(funcs)...);
+  }
+
+  // Same as above but the functions are run on the given pool instead of
+  // threads of their own. Example:
+  /*
+  auto [res_dbl, res_int] =
+    Lazy::runParallel(Lazy::sharedPool(), [](){ return 1.5; }, [](){ return 2; });
+*/
+  template <class... Funcs>
+  auto runParallel(Pool &pool, Funcs &&...funcs)
+  {
+    return runParallelOn(&pool, std::forward<Funcs>(funcs)...);
+  }
+
   // Callback functor which triggers notification
   // that the result is ready and can be retrived with Future::get().
   // Slot and index which identify the result are appended
@@ -588,6 +1084,133 @@ namespace Lazy
     }
   };
 
+  // Bounded multi-producer single-consumer ring buffer (after Dmitry Vyukov's
+  // bounded queue). Every cell has a sequence number which tells whether it
+  // is free for the producer of ticket n (seq == n) or holds the value of
+  // ticket n for the consumer (seq == n + 1), so producers only contend on
+  // the CAS of the tail and the consumer takes no lock at all.
+  // The consumer parks in pop() when the buffer is empty; producers wake it
+  // only if it is actually parked. pop() returns false once the buffer is
+  // empty and all the numProducers producers have called closeProducer().
+  template <class T>
+  class RingBuffer
+  {
+  public:
+    // Capacity is rounded up to a power of two.
+    explicit RingBuffer(std::size_t capacity, std::size_t numProducers = 1)
+        : _cells(roundUp(capacity)), _mask(_cells.size() - 1), _openProducers(numProducers)
+    {
+      for (std::size_t i = 0; i < _cells.size(); ++i)
+        _cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    RingBuffer(const RingBuffer &) = delete;
+    RingBuffer &operator=(const RingBuffer &) = delete;
+
+    // Producer side. Returns false if the buffer is full.
+    bool tryPush(T &value)
+    {
+      auto szTicket = _tail.load(std::memory_order_relaxed);
+      while (true)
+      {
+        auto &cell = _cells[szTicket & _mask];
+        auto szSeq = cell.seq.load(std::memory_order_acquire);
+        if (szSeq == szTicket)
+        {
+          if (_tail.compare_exchange_weak(szTicket, szTicket + 1, std::memory_order_relaxed))
+          {
+            cell.value.emplace(std::move(value));
+            cell.seq.store(szTicket + 1, std::memory_order_release);
+            signal();
+            return true;
+          }
+        }
+        else if (szSeq < szTicket)
+          return false; // The consumer has not emptied the cell yet
+        else
+          szTicket = _tail.load(std::memory_order_relaxed);
+      }
+    }
+
+    // Producer side. Yields while the buffer is full.
+    void push(T value)
+    {
+      while (!tryPush(value))
+        std::this_thread::yield();
+    }
+
+    // Producer side. Called once by each producer when it is done.
+    void closeProducer()
+    {
+      _openProducers.fetch_sub(1);
+      signal();
+    }
+
+    // Consumer side. Returns false if the buffer is empty.
+    bool tryPop(T &value)
+    {
+      auto &cell = _cells[_head & _mask];
+      if (cell.seq.load(std::memory_order_acquire) != _head + 1)
+        return false;
+      value = std::move(*cell.value);
+      cell.value.reset();
+      cell.seq.store(_head + _cells.size(), std::memory_order_release);
+      ++_head;
+      return true;
+    }
+
+    // Consumer side. Waits for a value. Returns false when the buffer
+    // is empty and all the producers are closed.
+    bool pop(T &value)
+    {
+      while (true)
+      {
+        if (tryPop(value))
+          return true;
+        if (_openProducers.load() == 0)
+          return tryPop(value); // Everything pushed before closing is visible now
+        _bSleeping.store(true);
+        auto uSignal = _signal.load();
+        bool bPopped = tryPop(value); // A push may have slipped in before the flag was set
+        if (!bPopped && _openProducers.load() != 0)
+          _signal.wait(uSignal);
+        _bSleeping.store(false);
+        if (bPopped)
+          return true;
+      }
+    }
+
+  private:
+    struct alignas(64) Cell
+    {
+      std::atomic_size_t seq{0};
+      std::optional<T> value;
+    };
+
+    static std::size_t roundUp(std::size_t n)
+    {
+      std::size_t szPow2 = 1;
+      while (szPow2 < n)
+        szPow2 <<= 1;
+      return szPow2;
+    }
+
+    void signal()
+    {
+      _signal.fetch_add(1);
+      if (_bSleeping.load())
+        _signal.notify_one();
+    }
+
+    std::vector<Cell> _cells;
+    std::size_t _mask;
+    alignas(64) std::atomic_size_t _tail{0}; // Next ticket for the producers
+    alignas(64) std::size_t _head = 0;       // Owned by the consumer
+    std::atomic_bool _bSleeping{false};
+    std::atomic<std::uint32_t> _signal{0};
+    std::atomic_size_t _openProducers;
+  };
+
   // Debug helper for finding out types T...
   template <class... T>
   void pretty_function(const T &...)
@@ -599,11 +1222,165 @@ namespace Lazy
 #endif
   }
 
-  // Executes "y = func(x)" for each x in vector vecX in a lock-free thread pool.
-  // Returns a vector of y's. The maxmum number of parallel threads is MaxThreads.
-  // If MaxThreads <= 0, use the number of cores.
+  // Describes how runForAll splits the indices 0...size()-1 between the threads.
+  // Example:
+  /*
+  auto vecY = Lazy::runForAll(vecX, Lazy::Partition::guided(), [](double x){ return 2 * x; });
+*/
+  struct Partition
+  {
+    enum class Kind
+    {
+      Static,  // Each thread gets one contiguous range of size()/numThreads indices.
+      Dynamic, // The threads take grain indices at a time from a shared counter.
+      Guided   // Like Dynamic, but the chunk shrinks with the number of indices
+               // left: remaining/(2*numThreads), never less than grain.
+    };
+
+    Kind kind = Kind::Dynamic;
+    std::size_t grain = 1;
+
+    static constexpr Partition staticRanges() noexcept
+    {
+      return {Kind::Static, 1};
+    }
+
+    static constexpr Partition dynamic(std::size_t grain = 1) noexcept
+    {
+      return {Kind::Dynamic, std::max<std::size_t>(grain, 1)};
+    }
+
+    static constexpr Partition guided(std::size_t minGrain = 1) noexcept
+    {
+      return {Kind::Guided, std::max<std::size_t>(minGrain, 1)};
+    }
+  };
+
+  // Hands out ranges [begin, end) of indices 0...size-1 to numThreads threads
+  // as described by the partition. The shared counter lives in a cache line
+  // of its own because every thread hammers it.
+  class RangeDispenser
+  {
+  public:
+    RangeDispenser(Partition part, std::size_t size, std::size_t numThreads)
+        : _part(part), _size(size), _numThreads(std::max<std::size_t>(numThreads, 1)) {}
+
+    // Thread-local state of one thread taking ranges.
+    struct Cursor
+    {
+      std::size_t iThread = 0;
+      bool bStaticTaken = false;
+    };
+
+    // Gets the next range for the thread. Returns false when all the
+    // indices have been handed out.
+    bool next(Cursor &cursor, std::size_t &begin, std::size_t &end) noexcept
+    {
+      switch (_part.kind)
+      {
+      case Partition::Kind::Static:
+        if (cursor.bStaticTaken)
+          return false;
+        cursor.bStaticTaken = true;
+        begin = _size * cursor.iThread / _numThreads;
+        end = _size * (cursor.iThread + 1) / _numThreads;
+        return begin < end;
+
+      case Partition::Kind::Dynamic:
+        if (_next.load(std::memory_order_relaxed) >= _size)
+          return false; // Avoid the RMW once everything is gone
+        begin = _next.fetch_add(_part.grain, std::memory_order_relaxed);
+        if (begin >= _size)
+          return false;
+        end = std::min(begin + _part.grain, _size);
+        return true;
+
+      case Partition::Kind::Guided:
+        begin = _next.load(std::memory_order_relaxed);
+        while (begin < _size)
+        {
+          auto szChunk = std::max(_part.grain, (_size - begin) / (2 * _numThreads));
+          if (_next.compare_exchange_weak(begin, begin + szChunk, std::memory_order_relaxed))
+          {
+            end = std::min(begin + szChunk, _size);
+            return true;
+          }
+        }
+        return false;
+      }
+      return false;
+    }
+
+  private:
+    Partition _part;
+    std::size_t _size;
+    std::size_t _numThreads;
+    alignas(64) std::atomic_size_t _next{0};
+  };
+
+  // Runs worker(iThread, numThreads) in numThreads parallel threads and waits
+  // for all of them to finish. If MaxThreads > 0, there are MaxThreads
+  // threads living in an array in stack, otherwise there is one thread
+  // per CPU the process may use but no more than numTasks.
+  template <int MaxThreads = 0, class Worker>
+  void runWorkers(std::size_t numTasks, Worker &&worker)
+  {
+    if constexpr (MaxThreads > 0)
+    { // Threadpool is an array of threads living in stack.
+      std::array<std::thread, MaxThreads> aThreadPool;
+      for (std::size_t i = 0; i < aThreadPool.size(); ++i)
+        aThreadPool[i] = std::thread(worker, i, aThreadPool.size());
+
+      for (std::thread &thr : aThreadPool)
+        joinThread(&thr);
+    }
+    else
+    { // Threadpool is a vector of threads living in heap.
+      auto uNumThreads = std::min(Topology::cpuCount(), numTasks);
+      std::vector<std::thread> vecThreadPool(uNumThreads);
+      for (std::size_t i = 0; i < vecThreadPool.size(); ++i)
+        vecThreadPool[i] = std::thread(worker, i, vecThreadPool.size());
+
+      for (std::thread &thr : vecThreadPool)
+        joinThread(&thr);
+    }
+  }
+
+  // Number of threads runWorkers<MaxThreads>(pPool, numTasks, ...) will use.
+  // With a pool, it is the workers plus the calling thread, but no more
+  // than MaxThreads (if MaxThreads > 0) or numTasks.
+  template <int MaxThreads = 0>
+  std::size_t numWorkers(Pool *pPool, std::size_t numTasks)
+  {
+    if (pPool)
+    {
+      auto uNumThreads = std::min(pPool->size() + 1, numTasks);
+      return MaxThreads > 0 ? std::min(uNumThreads, std::size_t(MaxThreads)) : uNumThreads;
+    }
+    if constexpr (MaxThreads > 0)
+      return MaxThreads;
+    else
+      return std::min(Topology::cpuCount(), numTasks);
+  }
+
+  // Same as runWorkers above, but runs the workers on the parked threads
+  // of the given pool (see Pool::forkJoin) if pPool is not nullptr.
+  template <int MaxThreads = 0, class Worker>
+  void runWorkers(Pool *pPool, std::size_t numTasks, Worker &&worker)
+  {
+    if (pPool)
+      pPool->forkJoin(numWorkers<MaxThreads>(pPool, numTasks), worker);
+    else
+      runWorkers<MaxThreads>(numTasks, std::forward<Worker>(worker));
+  }
+
+  // Executes "y = func(x)" for each x in vector vecX either in threads of
+  // its own (pPool == nullptr) or on the given pool.
+  // See the runForAll overloads below.
+  // Indices which have not started when a task throws or *pToken gets set
+  // are skipped.
   template <int MaxThreads = 0, class Vec, class Func>
-  auto runForAll(const Vec &vecX, Func &&func)
+  auto runForAllOn(Pool *pPool, const Vec &vecX, Partition part, Func &&func, StopToken *pToken = nullptr)
   {
     using U = typename Vec::value_type; // input type
     // The functions take stop token as the first parameter
@@ -620,14 +1397,20 @@ namespace Lazy
       if constexpr (!bVoid)
         vecY.resize(vecX.size()); // Allocate only if needed (i.e non-const return type)
       std::exception_ptr pException;
-      std::atomic_size_t szExceptionCount{0};  // Number of tasks that have tried to raise an exception.
-      std::atomic_size_t szNumStartedTasks{0}; // Number of tasks that have either finished or running.
-      auto worker = [&]() {                    // Worker to run in each thread in the thread pool.
-        do
+      std::atomic_size_t szExceptionCount{0}; // Number of tasks that have tried to raise an exception.
+      auto isStopped = [&]() {
+        return szExceptionCount.load(std::memory_order_relaxed) > 0 || (pToken && *pToken);
+      };
+      RangeDispenser ranges(part, vecX.size(), numWorkers<MaxThreads>(pPool, vecX.size()));
+      auto worker = [&](std::size_t iThread, std::size_t) { // Worker to run in each thread in the thread pool.
+        RangeDispenser::Cursor cursor{iThread};
+        std::size_t szBegin, szEnd;
+        while (ranges.next(cursor, szBegin, szEnd))
         {
-          auto szIndex = szNumStartedTasks.fetch_add(1);
-          if (szIndex < vecX.size())
-          { // There are vecX.size() tasks to run in total
+          for (auto szIndex = szBegin; szIndex < szEnd; ++szIndex)
+          {
+            if (isStopped())
+              return; // Skip the rest of the batch
             try
             {
               if constexpr (bVoid)
@@ -639,33 +1422,17 @@ namespace Lazy
             {
               auto szExceptionsSoFar = szExceptionCount.fetch_add(1);
               if (szExceptionsSoFar == 0) // Only one exception will be stored
+              {
                 pException = std::current_exception();
+                if (pToken)
+                  pToken->setValue(1); // Let the running tasks know
+              }
             }
-          } // if
-        } while (szNumStartedTasks.load() <= vecX.size());
+          } // for
+        }
       }; // worker
 
-      if constexpr (MaxThreads > 0)
-      { // Threadpool is an array of threads living in stack.
-        std::array<std::thread, MaxThreads> aThreadPool;
-        for (auto &thr : aThreadPool)
-          thr = std::thread(worker);
-
-        for (std::thread &thr : aThreadPool)
-          if (thr.joinable())
-            thr.join();
-      }
-      else
-      { // Threadpool is a vector of threads living in heap.
-        auto uNumThreads = std::min(std::size_t(std::thread::hardware_concurrency()), vecX.size());
-        std::vector<std::thread> vecThreadPool(uNumThreads);
-        for (auto &thr : vecThreadPool)
-          thr = std::thread(worker);
-
-        for (std::thread &thr : vecThreadPool)
-          if (thr.joinable())
-            thr.join();
-      }
+      runWorkers<MaxThreads>(pPool, vecX.size(), worker);
 
       // Deal with possible exception
       if (pException)
@@ -680,16 +1447,424 @@ namespace Lazy
     { // func takes a stop token and a parameter.
       StopToken token;
       auto funcWithToken = [&token, f = std::forward<Func>(func)](const U &x) { return f(&token, x); };
-      return runForAll<MaxThreads>(vecX, funcWithToken);
+      return runForAllOn<MaxThreads>(pPool, vecX, part, funcWithToken, &token);
     }
     else
       static_assert(bOneParam || bStopTokenAndParam,
                     "Function must either take one parameter or (StopToken* and a parameter).");
   }
 
+  // Executes "y = func(x)" for each x in vector vecX in a lock-free thread pool.
+  // The indices of vecX are handed out to the threads as described by
+  // the partition, see Partition.
+  // Returns a vector of y's. The maxmum number of parallel threads is MaxThreads.
+  // If MaxThreads <= 0, use the number of cores.
+  // Once a task throws, the indices which have not started yet are skipped
+  // and the first exception is rethrown. If func takes a StopToken*, the
+  // token is set at the first exception, and setting it from func skips
+  // the rest of the batch: the skipped y's are left default constructed.
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runForAll(const Vec &vecX, Partition part, Func &&func)
+  {
+    return runForAllOn<MaxThreads>(nullptr, vecX, part, std::forward<Func>(func));
+  }
+
+  // Executes "y = func(x)" for each x in vector vecX in a lock-free thread pool.
+  // Returns a vector of y's. The maxmum number of parallel threads is MaxThreads.
+  // If MaxThreads <= 0, use the number of cores.
+  // The threads take one index at a time, i.e. Partition::dynamic(1).
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runForAll(const Vec &vecX, Func &&func)
+  {
+    return runForAllOn<MaxThreads>(nullptr, vecX, Partition::dynamic(1), std::forward<Func>(func));
+  }
+
+  // Same as the two overloads above, but the loop runs on the parked
+  // workers of the given pool and the calling thread, so no threads are
+  // started or joined per call. Example:
+  /*
+  Lazy::Pool pool;
+  for (auto &batch : batches)
+    results.push_back(Lazy::runForAll(pool, batch, [](double x){ return 2 * x; }));
+*/
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runForAll(Pool &pool, const Vec &vecX, Partition part, Func &&func)
+  {
+    return runForAllOn<MaxThreads>(&pool, vecX, part, std::forward<Func>(func));
+  }
+
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runForAll(Pool &pool, const Vec &vecX, Func &&func)
+  {
+    return runForAllOn<MaxThreads>(&pool, vecX, Partition::dynamic(1), std::forward<Func>(func));
+  }
+
+  // A value in a cache line of its own, so that per-thread data
+  // written by different threads doesn't share a line.
+  template <class T>
+  struct alignas(64) Padded
+  {
+    T value;
+  };
+
+  // Computes reduceFn(...reduceFn(reduceFn(init, mapFn(x0)), mapFn(x1))..., mapFn(xn))
+  // for vecX either in threads of its own (pPool == nullptr) or on the given pool.
+  // See the runReduce overloads below.
+  // Cancellation works like in runForAllOn.
+  template <int MaxThreads = 0, class Vec, class T, class MapFn, class ReduceFn>
+  T runReduceOn(Pool *pPool, const Vec &vecX, Partition part, T init, MapFn &&mapFn, ReduceFn &&reduceFn,
+                StopToken *pToken = nullptr)
+  {
+    using U = typename Vec::value_type; // input type
+    // The map function takes stop token as the first parameter
+    constexpr bool bStopTokenAndParam = std::is_invocable_v<MapFn, StopToken *, U>;
+    // The map function takes one parameter
+    constexpr bool bOneParam = std::is_invocable_v<MapFn, U>;
+    if constexpr (bOneParam)
+    {
+      const auto uNumThreads = numWorkers<MaxThreads>(pPool, vecX.size());
+      // One partial result per thread. Empty until the thread has mapped its first element.
+      std::vector<Padded<std::optional<T>>> vecPartial(uNumThreads);
+      std::exception_ptr pException;
+      std::atomic_size_t szExceptionCount{0}; // Number of tasks that have tried to raise an exception.
+      auto isStopped = [&]() {
+        return szExceptionCount.load(std::memory_order_relaxed) > 0 || (pToken && *pToken);
+      };
+      RangeDispenser ranges(part, vecX.size(), uNumThreads);
+      auto worker = [&](std::size_t iThread, std::size_t) {
+        auto &partial = vecPartial[iThread].value;
+        RangeDispenser::Cursor cursor{iThread};
+        std::size_t szBegin, szEnd;
+        while (ranges.next(cursor, szBegin, szEnd))
+        {
+          for (auto szIndex = szBegin; szIndex < szEnd; ++szIndex)
+          {
+            if (isStopped())
+              return; // Skip the rest of the batch
+            try
+            {
+              if (partial)
+                partial.emplace(reduceFn(std::move(*partial), mapFn(vecX[szIndex])));
+              else
+                partial.emplace(mapFn(vecX[szIndex]));
+            }
+            catch (...)
+            {
+              auto szExceptionsSoFar = szExceptionCount.fetch_add(1);
+              if (szExceptionsSoFar == 0) // Only one exception will be stored
+              {
+                pException = std::current_exception();
+                if (pToken)
+                  pToken->setValue(1); // Let the running tasks know
+              }
+            }
+          } // for
+        }
+      }; // worker
+
+      runWorkers<MaxThreads>(pPool, vecX.size(), worker);
+
+      // Deal with possible exception
+      if (pException)
+        std::rethrow_exception(pException);
+
+      for (auto &partial : vecPartial)
+        if (partial.value)
+          init = reduceFn(std::move(init), std::move(*partial.value));
+      return init;
+    } // mapFn takes one parameter
+    else if constexpr (bStopTokenAndParam)
+    { // mapFn takes a stop token and a parameter.
+      StopToken token;
+      auto mapWithToken = [&token, f = std::forward<MapFn>(mapFn)](const U &x) { return f(&token, x); };
+      return runReduceOn<MaxThreads>(pPool, vecX, part, std::move(init), mapWithToken, std::forward<ReduceFn>(reduceFn),
+                                     &token);
+    }
+    else
+    {
+      static_assert(bOneParam || bStopTokenAndParam,
+                    "Map function must either take one parameter or (StopToken* and a parameter).");
+      return init;
+    }
+  }
+
+  // Parallel transform-reduce: maps each x in vecX with mapFn and combines the
+  // results and init with reduceFn. Each thread accumulates a partial result
+  // of its own, and the partials are combined at the end, so no vector of
+  // mapped values is ever built.
+  // reduceFn must be associative and commutative (the order in which the
+  // elements are combined is unspecified), and T must be constructible from
+  // the return value of mapFn.
+  // The maxmum number of parallel threads is MaxThreads.
+  // If MaxThreads <= 0, use the number of cores.
+  // Example:
+  /*
+  double sumOfSquares = Lazy::runReduce(Lazy::Sequence(1000), 0.0,
+                                        [](std::size_t i) { return double(i * i); },
+                                        std::plus<>());
+*/
+  template <int MaxThreads = 0, class Vec, class T, class MapFn, class ReduceFn>
+  T runReduce(const Vec &vecX, Partition part, T init, MapFn &&mapFn, ReduceFn &&reduceFn)
+  {
+    return runReduceOn<MaxThreads>(nullptr, vecX, part, std::move(init),
+                                   std::forward<MapFn>(mapFn), std::forward<ReduceFn>(reduceFn));
+  }
+
+  template <int MaxThreads = 0, class Vec, class T, class MapFn, class ReduceFn>
+  T runReduce(const Vec &vecX, T init, MapFn &&mapFn, ReduceFn &&reduceFn)
+  {
+    return runReduceOn<MaxThreads>(nullptr, vecX, Partition::dynamic(1), std::move(init),
+                                   std::forward<MapFn>(mapFn), std::forward<ReduceFn>(reduceFn));
+  }
+
+  // Same as the two overloads above, but run on the given pool.
+  template <int MaxThreads = 0, class Vec, class T, class MapFn, class ReduceFn>
+  T runReduce(Pool &pool, const Vec &vecX, Partition part, T init, MapFn &&mapFn, ReduceFn &&reduceFn)
+  {
+    return runReduceOn<MaxThreads>(&pool, vecX, part, std::move(init),
+                                   std::forward<MapFn>(mapFn), std::forward<ReduceFn>(reduceFn));
+  }
+
+  template <int MaxThreads = 0, class Vec, class T, class MapFn, class ReduceFn>
+  T runReduce(Pool &pool, const Vec &vecX, T init, MapFn &&mapFn, ReduceFn &&reduceFn)
+  {
+    return runReduceOn<MaxThreads>(&pool, vecX, Partition::dynamic(1), std::move(init),
+                                   std::forward<MapFn>(mapFn), std::forward<ReduceFn>(reduceFn));
+  }
+
+  // Executes "y = func(x)" for x in vecX until one of the calls returns,
+  // either in threads of its own (pPool == nullptr) or on the given pool.
+  // See the runAnyOf overloads below.
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runAnyOfOn(Pool *pPool, const Vec &vecX, Partition part, Func &&func, StopToken *pToken = nullptr)
+  {
+    using U = typename Vec::value_type; // input type
+    // The functions take stop token as the first parameter
+    constexpr bool bStopTokenAndParam = std::is_invocable_v<Func, StopToken *, U>;
+    // The functions take one parameter
+    constexpr bool bOneParam = std::is_invocable_v<Func, U>;
+    if constexpr (bOneParam)
+    {
+      using T = decltype(func(std::declval<U>())); // output type
+      static_assert(!std::is_same_v<T, void>, "runAnyOf needs a function which returns a value.");
+
+      std::optional<std::pair<std::size_t, T>> result; // Index and value of the winner
+      std::atomic_bool bDone{false};                   // Set by the winner
+      std::exception_ptr pException;
+      std::atomic_size_t szExceptionCount{0}; // Number of tasks that have tried to raise an exception.
+      RangeDispenser ranges(part, vecX.size(), numWorkers<MaxThreads>(pPool, vecX.size()));
+      auto worker = [&](std::size_t iThread, std::size_t) {
+        RangeDispenser::Cursor cursor{iThread};
+        std::size_t szBegin, szEnd;
+        while (ranges.next(cursor, szBegin, szEnd))
+        {
+          for (auto szIndex = szBegin; szIndex < szEnd; ++szIndex)
+          {
+            if (bDone.load(std::memory_order_relaxed) || (pToken && pToken->value() > 1))
+              return; // Somebody else has already won
+            try
+            {
+              auto y = func(vecX[szIndex]);
+              if (!bDone.exchange(true))
+              {
+                result.emplace(szIndex, std::move(y));
+                if (pToken)
+                  pToken->setValue(1); // Let the running tasks know
+              }
+              return;
+            }
+            catch (...)
+            {
+              auto szExceptionsSoFar = szExceptionCount.fetch_add(1);
+              if (szExceptionsSoFar == 0) // Only one exception will be stored
+                pException = std::current_exception();
+            }
+          } // for
+        }
+      }; // worker
+
+      runWorkers<MaxThreads>(pPool, vecX.size(), worker);
+
+      // Only if nobody succeeded, deal with possible exception
+      if (!result && pException)
+        std::rethrow_exception(pException);
+      return result;
+    } // func takes one parameter
+    else if constexpr (bStopTokenAndParam)
+    { // func takes a stop token and a parameter.
+      StopToken token;
+      auto funcWithToken = [&token, f = std::forward<Func>(func)](const U &x) { return f(&token, x); };
+      return runAnyOfOn<MaxThreads>(pPool, vecX, part, funcWithToken, &token);
+    }
+    else
+      static_assert(bOneParam || bStopTokenAndParam,
+                    "Function must either take one parameter or (StopToken* and a parameter).");
+  }
+
+  // "Any-of" version of runForAll: returns as soon as one call of func has
+  // returned a value (the calls already running are waited for, but no new
+  // ones are started). Returns the index of the winning x and its y, or an
+  // empty optional if vecX is empty. Exceptions don't stop the batch;
+  // only if every call throws, the first exception is rethrown.
+  // If func takes a StopToken*, the token is set to 1 when a winner has been
+  // found, so that the running calls can give up early. A call may also
+  // set the token to a value > 1 to stop the batch without a winner.
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runAnyOf(const Vec &vecX, Partition part, Func &&func)
+  {
+    return runAnyOfOn<MaxThreads>(nullptr, vecX, part, std::forward<Func>(func));
+  }
+
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runAnyOf(const Vec &vecX, Func &&func)
+  {
+    return runAnyOfOn<MaxThreads>(nullptr, vecX, Partition::dynamic(1), std::forward<Func>(func));
+  }
+
+  // Same as the two overloads above, but run on the given pool.
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runAnyOf(Pool &pool, const Vec &vecX, Partition part, Func &&func)
+  {
+    return runAnyOfOn<MaxThreads>(&pool, vecX, part, std::forward<Func>(func));
+  }
+
+  template <int MaxThreads = 0, class Vec, class Func>
+  auto runAnyOf(Pool &pool, const Vec &vecX, Func &&func)
+  {
+    return runAnyOfOn<MaxThreads>(&pool, vecX, Partition::dynamic(1), std::forward<Func>(func));
+  }
+
+  // Executes "y = func(x)" for each x in vecX and calls onResult(index, y)
+  // in the calling thread for each y as soon as it is ready, i.e. in
+  // completion order, not in index order. The workers run in threads of
+  // their own (pPool == nullptr) or as jobs on the given pool, and hand the
+  // results over through a RingBuffer of the given capacity. A full buffer
+  // makes the workers wait for the consumer.
+  // See the whenEach overloads below.
+  template <int MaxThreads = 0, class Vec, class Func, class OnResult>
+  void whenEachOn(Pool *pPool, const Vec &vecX, Func &&func, OnResult &&onResult, std::size_t capacity,
+                  StopToken *pToken = nullptr)
+  {
+    using U = typename Vec::value_type; // input type
+    // The functions take stop token as the first parameter
+    constexpr bool bStopTokenAndParam = std::is_invocable_v<Func, StopToken *, U>;
+    // The functions take one parameter
+    constexpr bool bOneParam = std::is_invocable_v<Func, U>;
+    if constexpr (bOneParam)
+    {
+      using T = decltype(func(std::declval<U>())); // output type
+      static_assert(!std::is_same_v<T, void>, "whenEach needs a function which returns a value.");
+
+      // The calling thread is busy consuming, so it does not take part.
+      const auto uNumThreads = pPool ? std::min(pPool->size(), vecX.size()) : numWorkers<MaxThreads>(nullptr, vecX.size());
+      RingBuffer<std::pair<std::size_t, T>> ring(capacity, uNumThreads);
+      std::exception_ptr pException;
+      std::atomic_size_t szExceptionCount{0}; // Number of tasks that have tried to raise an exception.
+      std::atomic_bool bConsumerFailed{false};
+      std::atomic_size_t szNext{0};
+      std::atomic_size_t szWorkersLeft{uNumThreads};
+      auto isStopped = [&]() {
+        return szExceptionCount.load(std::memory_order_relaxed) > 0 || bConsumerFailed.load(std::memory_order_relaxed) ||
+               (pToken && *pToken);
+      };
+      auto worker = [&]() {
+        for (auto szIndex = szNext.fetch_add(1); szIndex < vecX.size() && !isStopped(); szIndex = szNext.fetch_add(1))
+        {
+          try
+          {
+            ring.push({szIndex, func(vecX[szIndex])});
+          }
+          catch (...)
+          {
+            auto szExceptionsSoFar = szExceptionCount.fetch_add(1);
+            if (szExceptionsSoFar == 0) // Only one exception will be stored
+            {
+              pException = std::current_exception();
+              if (pToken)
+                pToken->setValue(1); // Let the running tasks know
+            }
+          }
+        }
+        ring.closeProducer();
+        szWorkersLeft.fetch_sub(1); // Last touch of anything on the caller's stack
+      }; // worker
+
+      std::vector<std::thread> vecThreadPool(pPool ? 0 : uNumThreads);
+      for (auto &thr : vecThreadPool)
+        thr = std::thread(worker);
+      if (pPool)
+        for (std::size_t i = 0; i < uNumThreads; ++i)
+          pPool->post([&worker]() { worker(); });
+
+      std::pair<std::size_t, T> item;
+      std::exception_ptr pConsumerException;
+      while (ring.pop(item))
+      {
+        if (pConsumerException)
+          continue; // Keep draining so that the workers don't block
+        try
+        {
+          onResult(item.first, std::move(item.second));
+        }
+        catch (...)
+        {
+          pConsumerException = std::current_exception();
+          bConsumerFailed.store(true);
+        }
+      }
+
+      for (std::thread &thr : vecThreadPool)
+        joinThread(&thr);
+      // The pool jobs still touch the ring after closing it. They are on
+      // their last instructions, so yield rather than park: a notify from
+      // them could hit a stack frame which is already gone.
+      while (szWorkersLeft.load() != 0)
+        std::this_thread::yield();
+
+      if (pConsumerException)
+        std::rethrow_exception(pConsumerException);
+      if (pException)
+        std::rethrow_exception(pException);
+    } // func takes one parameter
+    else if constexpr (bStopTokenAndParam)
+    { // func takes a stop token and a parameter.
+      StopToken token;
+      auto funcWithToken = [&token, f = std::forward<Func>(func)](const U &x) { return f(&token, x); };
+      whenEachOn<MaxThreads>(pPool, vecX, funcWithToken, std::forward<OnResult>(onResult), capacity, &token);
+    }
+    else
+      static_assert(bOneParam || bStopTokenAndParam,
+                    "Function must either take one parameter or (StopToken* and a parameter).");
+  }
+
+  // Streaming version of runForAll: onResult(index, y) is called in the
+  // calling thread for each y in the order the y's become ready, so the
+  // next stage can start on the early results instead of waiting for the
+  // slowest element. Example:
+  /*
+  Lazy::whenEach(vecUrls, [](const std::string &url) { return download(url); },
+                 [&](std::size_t i, Page page) { index.add(i, std::move(page)); });
+*/
+  // Cancellation and exceptions work like in runForAll; if onResult throws,
+  // the batch is stopped and its exception is rethrown.
+  template <int MaxThreads = 0, class Vec, class Func, class OnResult>
+  void whenEach(const Vec &vecX, Func &&func, OnResult &&onResult, std::size_t capacity = 1024)
+  {
+    whenEachOn<MaxThreads>(nullptr, vecX, std::forward<Func>(func), std::forward<OnResult>(onResult), capacity);
+  }
+
+  // Same as above, but the workers are jobs on the given pool. Must not be
+  // called from a job of the same pool.
+  template <int MaxThreads = 0, class Vec, class Func, class OnResult>
+  void whenEach(Pool &pool, const Vec &vecX, Func &&func, OnResult &&onResult, std::size_t capacity = 1024)
+  {
+    whenEachOn<MaxThreads>(&pool, vecX, std::forward<Func>(func), std::forward<OnResult>(onResult), capacity);
+  }
+
   // Helper for array overload of runForAll(...)
   template <class Arr, std::size_t... I, class Func>
-  auto runForAllInArray(const Arr &arrX, Func &&func, std::index_sequence<I...>)
+  auto runForAllInArray(Pool *pPool, const Arr &arrX, Func &&func, std::index_sequence<I...>,
+                        StopToken *pToken = nullptr)
   {
     constexpr std::size_t N = sizeof...(I);
     using U = typename Arr::value_type; // input type
@@ -702,10 +1877,13 @@ namespace Lazy
     {
       using T = decltype(func(std::declval<U>())); // output type
 
+      CancelScope scope{pToken};
       std::array<SyncCore, N> aCores;
-      std::array aFutures = {future<T>(arrX[I]).then(func).finalize(&aCores[I])...};
-      std::array aStates = {aFutures[I].run()...};
+      std::array aFutures = {future<T>(arrX[I]).then(scope.wrap(func)).finalize(&aCores[I])...};
+      std::array aStates = {runOn(pPool, aFutures[I])...};
 
+      (aFutures[I].wait(aStates[I]), ...); // All must be done before any get() throws
+      scope.rethrow();
       std::array arrY = {aFutures[I].get(aStates[I])...};
       return arrY;
     } // func takes one parameter
@@ -713,7 +1891,7 @@ namespace Lazy
     { // func takes a stop token and a parameter.
       StopToken token;
       auto funcWithToken = [&token, f = std::forward<Func>(func)](const U &x) { return f(&token, x); };
-      return runForAll(arrX, funcWithToken);
+      return runForAllInArray(pPool, arrX, funcWithToken, std::index_sequence<I...>{}, &token);
     }
     else
       static_assert(bOneParam || bStopTokenAndParam,
@@ -726,7 +1904,15 @@ namespace Lazy
   template <int MaxThreads = 0, class U, std::size_t N, class Func>
   auto runForAll(const std::array<U, N> &arrX, Func &&func)
   {
-    return runForAllInArray(arrX, std::forward<Func>(func), std::make_index_sequence<N>{});
+    return runForAllInArray(nullptr, arrX, std::forward<Func>(func), std::make_index_sequence<N>{});
+  }
+
+  // Same as above but the elements are processed on the given pool
+  // instead of a thread per element.
+  template <class U, std::size_t N, class Func>
+  auto runForAll(Pool &pool, const std::array<U, N> &arrX, Func &&func)
+  {
+    return runForAllInArray(&pool, arrX, std::forward<Func>(func), std::make_index_sequence<N>{});
   }
 
   // Executes "y = func(x)" for each x in the initializer_list in a separate thread.
@@ -794,6 +1980,28 @@ auto sqrt1 = Lazy::nested(1, // initial value
     return runForAll<MaxThreads>(seq, nestedFuncs);
   }
 
+  // Pool versions of the nested overloads above.
+  template <int MaxThreads = 0, class U, class... Funcs>
+  auto runForAll(Pool &pool, const std::vector<U> &x, Funcs &&...funcs)
+  {
+    auto nestedFuncs = [&funcs...](auto t) { return nested(t, funcs...); };
+    return runForAll<MaxThreads>(pool, x, nestedFuncs);
+  }
+
+  template <int MaxThreads = 0, class U, class... Funcs>
+  auto runForAll(Pool &pool, std::initializer_list<U> lstX, Funcs &&...funcs)
+  {
+    auto nestedFuncs = [&funcs...](auto t) { return nested(t, funcs...); };
+    return runForAll<MaxThreads>(pool, std::vector<U>{lstX}, nestedFuncs);
+  }
+
+  template <int MaxThreads = 0, class... Funcs>
+  auto runForAll(Pool &pool, Sequence seq, Funcs &&...funcs)
+  {
+    auto nestedFuncs = [&funcs...](auto t) { return nested(t, funcs...); };
+    return runForAll<MaxThreads>(pool, seq, nestedFuncs);
+  }
+
 } // namespace Lazy
 
 #endif // LAZY_H
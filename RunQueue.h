@@ -0,0 +1,126 @@
+#ifndef RUN_QUEUE_H
+#define RUN_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+
+#include "SchedStats.h"
+
+// The queue of a run loop any number of threads may drain. It is intrusive:
+// Node is whatever the loop queues, with a `Node *next` member for the
+// queue's use, and lives wherever the loop keeps it, so queueing does not
+// allocate. Producers push onto a lock-free stack. Consumers take turns at
+// a ready list, which is refilled from the stack in one go and reversed on
+// the way, so nodes come out in the order they were pushed.
+// A consumer with nothing to pop parks. A push wakes one parked consumer,
+// and a consumer which leaves nodes in the ready list wakes the next, so a
+// burst is taken up by the consumers it needs, one wake-up at a time.
+/* Example:
+   RunQueue<Task> queue;
+   queue.push(&task);                        // any thread
+   while (!queue.stopped())                  // each consumer
+     if (Task *t = queue.pop()) t->run(); else queue.park();
+*/
+
+template <typename Node>
+class RunQueue
+{
+public:
+  // If given, stats counts the wake-ups, and park the time spent asleep
+  explicit RunQueue(SchedStats::Stats *stats = nullptr) noexcept
+      : _stats(stats)
+  {
+  }
+
+  // Any thread. Once pushed, the node may be popped at any moment.
+  void push(Node *node) noexcept
+  {
+    node->next = _head.load(std::memory_order_relaxed);
+    while (!_head.compare_exchange_weak(node->next, node, std::memory_order_seq_cst, std::memory_order_relaxed))
+      ;
+    if (_sleepers.load() > 0)
+      wake(false);
+  }
+
+  // Consumers. The oldest node, or nullptr if there is none.
+  Node *pop() noexcept
+  {
+    std::lock_guard lock{_readyMutex};
+    if (_ready == nullptr)
+    {
+      Node *stack = _head.exchange(nullptr, std::memory_order_acquire);
+      if (stack == nullptr)
+        return nullptr;
+      std::size_t count = 0;
+      while (stack != nullptr)
+      {
+        Node *next = stack->next;
+        stack->next = _ready;
+        _ready = stack;
+        stack = next;
+        ++count;
+      }
+      _readyCount.store(count);
+    }
+    Node *node = std::exchange(_ready, _ready->next);
+    // More left than this thread can take: pass it on
+    if (_readyCount.fetch_sub(1) > 1 && _sleepers.load() > 0)
+      wake(false);
+    return node;
+  }
+
+  // Consumers. Sleeps until something is pushed or stop() is called,
+  // unless that has happened already. worker is the index of the caller's
+  // Worker in the stats.
+  void park(std::size_t worker = 0) noexcept
+  {
+    const std::uint32_t seen = _epoch.load();
+    _sleepers.fetch_add(1);
+    if (_head.load() == nullptr && _readyCount.load() == 0 && !_stopped.load())
+    {
+      const auto parked = _stats ? _stats->worker(worker).parking() : SchedStats::Stamp{};
+      _epoch.wait(seen);
+      if (_stats)
+        _stats->worker(worker).unparked(parked);
+    }
+    _sleepers.fetch_sub(1);
+  }
+
+  // Wakes every parked consumer, and from now on stopped() holds
+  void stop() noexcept
+  {
+    _stopped.store(true);
+    wake(true);
+  }
+
+  bool stopped() const noexcept
+  {
+    return _stopped.load(std::memory_order_acquire);
+  }
+
+private:
+  void wake(bool all) noexcept
+  {
+    if (_stats)
+      _stats->wokeUp();
+    _epoch.fetch_add(1);
+    if (all)
+      _epoch.notify_all();
+    else
+      _epoch.notify_one();
+  }
+
+  std::atomic<Node *> _head{nullptr};
+  std::mutex _readyMutex;
+  Node *_ready = nullptr;
+  std::atomic<std::size_t> _readyCount{0};
+  std::atomic<std::size_t> _sleepers{0};
+  std::atomic<std::uint32_t> _epoch{0};
+  std::atomic<bool> _stopped{false};
+  SchedStats::Stats *_stats;
+};
+
+#endif // RUN_QUEUE_H
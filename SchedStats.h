@@ -0,0 +1,325 @@
+#ifndef SCHED_STATS_H
+#define SCHED_STATS_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Scheduler counters for the pools and run loops: how much was queued and,
+// per worker, how many tasks it ran, how many it stole, how often it parked,
+// how long it was busy and idle, and a histogram of the time tasks spent
+// between being queued and being started. The latter tells queueing delay
+// apart from execution time when latency goes up.
+// Each worker writes to its own cache line with relaxed atomics; snapshot()
+// can be called from any thread at any time.
+// Counting is compiled in with SCHED_STATS=1 (cmake -DSCHED_STATS=ON).
+// Without it every type here is empty and every function does nothing, so
+// the executors carry neither the state nor the clock reads.
+/* Example:
+   SchedStats::Snapshot stats = pool.stats();
+   SchedStats::WorkerSnapshot total = stats.total();
+   printf("queued %zu, p99 wait %llu ns, busy %.0f%%\n", stats.queueDepth,
+          (unsigned long long)total.wait.percentileNs(0.99), 100 * total.utilisation());
+*/
+
+#ifndef SCHED_STATS
+#define SCHED_STATS 0
+#endif
+
+namespace SchedStats
+{
+
+  inline constexpr bool enabled = SCHED_STATS != 0;
+
+  using Clock = std::chrono::steady_clock;
+
+  // Enqueue-to-start times in power of two buckets: counts[0] holds the
+  // waits under 1ns, counts[i] those in [2^(i-1), 2^i) ns, and the last
+  // bucket everything longer.
+  struct WaitHistogram
+  {
+    static constexpr std::size_t Buckets = 40;
+
+    std::array<std::uint64_t, Buckets> counts{};
+    std::uint64_t sumNs = 0;
+
+    std::uint64_t count() const noexcept
+    {
+      std::uint64_t uCount = 0;
+      for (auto u : counts)
+        uCount += u;
+      return uCount;
+    }
+
+    double meanNs() const noexcept
+    {
+      const std::uint64_t uCount = count();
+      return uCount ? double(sumNs) / double(uCount) : 0.0;
+    }
+
+    // Upper bound of the bucket holding the q-quantile, q in [0, 1]
+    std::uint64_t percentileNs(double q) const noexcept
+    {
+      const std::uint64_t uCount = count();
+      if (uCount == 0)
+        return 0;
+      const auto uRank = static_cast<std::uint64_t>(std::clamp(q, 0.0, 1.0) * double(uCount - 1));
+      std::uint64_t uSeen = 0;
+      for (std::size_t i = 0; i < Buckets; ++i)
+        if ((uSeen += counts[i]) > uRank)
+          return i == 0 ? 0 : std::uint64_t(1) << i;
+      return std::uint64_t(1) << (Buckets - 1);
+    }
+
+    WaitHistogram &operator+=(const WaitHistogram &other) noexcept
+    {
+      for (std::size_t i = 0; i < Buckets; ++i)
+        counts[i] += other.counts[i];
+      sumNs += other.sumNs;
+      return *this;
+    }
+  };
+
+  struct WorkerSnapshot
+  {
+    std::uint64_t tasksRun = 0;
+    std::uint64_t steals = 0; // Tasks taken from another worker's queue
+    std::uint64_t parks = 0;  // Times the worker went to sleep for lack of work
+    std::uint64_t busyNs = 0; // Running tasks
+    std::uint64_t idleNs = 0; // Parked; the rest is spent looking for work
+    WaitHistogram wait;
+
+    // Share of the accounted time spent running tasks
+    double utilisation() const noexcept
+    {
+      return busyNs + idleNs ? double(busyNs) / double(busyNs + idleNs) : 0.0;
+    }
+
+    WorkerSnapshot &operator+=(const WorkerSnapshot &other) noexcept
+    {
+      tasksRun += other.tasksRun;
+      steals += other.steals;
+      parks += other.parks;
+      busyNs += other.busyNs;
+      idleNs += other.idleNs;
+      wait += other.wait;
+      return *this;
+    }
+  };
+
+  struct Snapshot
+  {
+    std::vector<WorkerSnapshot> workers; // Empty when counting is compiled out
+    std::uint64_t enqueued = 0;          // Items queued since construction
+    std::uint64_t wakeups = 0;           // Notifications sent to parked workers
+    std::size_t queueDepth = 0;          // Queued and not started yet
+
+    WorkerSnapshot total() const noexcept
+    {
+      WorkerSnapshot sum;
+      for (const auto &worker : workers)
+        sum += worker;
+      return sum;
+    }
+  };
+
+#if SCHED_STATS
+
+  // When an item was queued, or a worker started or parked
+  struct Stamp
+  {
+    std::int64_t ns = 0;
+  };
+
+  inline Stamp stampAt(Clock::time_point tp) noexcept
+  {
+    return Stamp{std::chrono::duration_cast<std::chrono::nanoseconds>(tp.time_since_epoch()).count()};
+  }
+
+  inline Stamp now() noexcept
+  {
+    return stampAt(Clock::now());
+  }
+
+  namespace detail
+  {
+    inline void add(std::atomic<std::uint64_t> &a, std::uint64_t d) noexcept
+    {
+      a.fetch_add(d, std::memory_order_relaxed);
+    }
+
+    inline std::uint64_t since(Stamp from, Stamp to) noexcept
+    {
+      return to.ns > from.ns ? std::uint64_t(to.ns - from.ns) : 0;
+    }
+
+    inline std::size_t bucket(std::uint64_t uNs) noexcept
+    {
+      return uNs == 0 ? 0 : std::min<std::size_t>(64 - __builtin_clzll(uNs), WaitHistogram::Buckets - 1);
+    }
+  }
+
+  // Counters of one worker. Normally only that worker writes them, but the
+  // updates are atomic, so threads taking turns at one run loop can share.
+  class alignas(64) Worker
+  {
+  public:
+    // Called as a task is taken off the queue; returns when it started
+    Stamp started(Stamp queued) noexcept
+    {
+      const Stamp start = now();
+      const std::uint64_t uWait = detail::since(queued, start);
+      detail::add(_tasksRun, 1);
+      detail::add(_waitSumNs, uWait);
+      detail::add(_wait[detail::bucket(uWait)], 1);
+      return start;
+    }
+
+    void finished(Stamp start) noexcept
+    {
+      detail::add(_busyNs, detail::since(start, now()));
+    }
+
+    void stole() noexcept
+    {
+      detail::add(_steals, 1);
+    }
+
+    // Called before going to sleep; returns when that was
+    Stamp parking() noexcept
+    {
+      detail::add(_parks, 1);
+      return now();
+    }
+
+    void unparked(Stamp parked) noexcept
+    {
+      detail::add(_idleNs, detail::since(parked, now()));
+    }
+
+    WorkerSnapshot snapshot() const noexcept
+    {
+      WorkerSnapshot s;
+      s.tasksRun = _tasksRun.load(std::memory_order_relaxed);
+      s.steals = _steals.load(std::memory_order_relaxed);
+      s.parks = _parks.load(std::memory_order_relaxed);
+      s.busyNs = _busyNs.load(std::memory_order_relaxed);
+      s.idleNs = _idleNs.load(std::memory_order_relaxed);
+      for (std::size_t i = 0; i < WaitHistogram::Buckets; ++i)
+        s.wait.counts[i] = _wait[i].load(std::memory_order_relaxed);
+      s.wait.sumNs = _waitSumNs.load(std::memory_order_relaxed);
+      return s;
+    }
+
+  private:
+    std::atomic<std::uint64_t> _tasksRun{0};
+    std::atomic<std::uint64_t> _steals{0};
+    std::atomic<std::uint64_t> _parks{0};
+    std::atomic<std::uint64_t> _busyNs{0};
+    std::atomic<std::uint64_t> _idleNs{0};
+    std::atomic<std::uint64_t> _waitSumNs{0};
+    std::array<std::atomic<std::uint64_t>, WaitHistogram::Buckets> _wait{};
+  };
+
+  // Counters of one executor: a Worker per worker thread, plus what the
+  // producers report, on a line of its own.
+  class Stats
+  {
+  public:
+    explicit Stats(std::size_t numWorkers)
+        : _numWorkers(numWorkers), _workers(std::make_unique<Worker[]>(numWorkers))
+    {
+    }
+
+    Worker &worker(std::size_t index) noexcept
+    {
+      return _workers[index];
+    }
+
+    // Called by the producer; the stamp goes along with the item
+    Stamp enqueued() noexcept
+    {
+      detail::add(_enqueued, 1);
+      return now();
+    }
+
+    void wokeUp(std::uint64_t count = 1) noexcept
+    {
+      detail::add(_wakeups, count);
+    }
+
+    Snapshot snapshot() const
+    {
+      Snapshot s;
+      s.workers.reserve(_numWorkers);
+      // The loads are relaxed, so a start may be seen before its enqueue;
+      // the depth is clamped rather than going negative
+      std::uint64_t uStarted = 0;
+      for (std::size_t i = 0; i < _numWorkers; ++i)
+      {
+        s.workers.push_back(_workers[i].snapshot());
+        uStarted += s.workers.back().tasksRun;
+      }
+      s.enqueued = _enqueued.load(std::memory_order_relaxed);
+      s.wakeups = _wakeups.load(std::memory_order_relaxed);
+      s.queueDepth = s.enqueued > uStarted ? std::size_t(s.enqueued - uStarted) : 0;
+      return s;
+    }
+
+  private:
+    std::size_t _numWorkers;
+    std::unique_ptr<Worker[]> _workers;
+    alignas(64) std::atomic<std::uint64_t> _enqueued{0};
+    std::atomic<std::uint64_t> _wakeups{0};
+  };
+
+#else
+
+  struct Stamp
+  {
+  };
+
+  inline Stamp stampAt(Clock::time_point) noexcept
+  {
+    return {};
+  }
+
+  inline Stamp now() noexcept
+  {
+    return {};
+  }
+
+  class Worker
+  {
+  public:
+    Stamp started(Stamp) noexcept { return {}; }
+    void finished(Stamp) noexcept {}
+    void stole() noexcept {}
+    Stamp parking() noexcept { return {}; }
+    void unparked(Stamp) noexcept {}
+    WorkerSnapshot snapshot() const noexcept { return {}; }
+  };
+
+  class Stats
+  {
+  public:
+    explicit Stats(std::size_t) noexcept {}
+    Worker &worker(std::size_t) noexcept { return _worker; }
+    Stamp enqueued() noexcept { return {}; }
+    void wokeUp(std::uint64_t = 1) noexcept {}
+    Snapshot snapshot() const { return {}; }
+
+  private:
+    [[no_unique_address]] Worker _worker;
+  };
+
+#endif
+
+} // namespace SchedStats
+
+#endif // SCHED_STATS_H
@@ -0,0 +1,266 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// Where worker threads run. The CPUs the process may use (its affinity
+// mask, so taskset and cgroup cpusets are honoured) are grouped by NUMA
+// node as listed in /sys/devices/system/node. A Placement maps worker
+// indices onto them, and the pools pin each worker to its CPU before the
+// worker allocates its queue. Memory is placed on the node of the thread
+// that first touches it, so the queue ends up next to the worker, and
+// stealing prefers victims on the thief's own node.
+// The default Placement pins nothing and leaves it all to the OS, as a
+// plain std::thread would.
+/* Example:
+   ThreadPool pool{Topology::Placement::compact()};   // one pinned worker per CPU
+   Lazy::Pool pool2{Topology::Placement::onNode(1)};  // the CPUs of node 1 only
+*/
+
+namespace Topology
+{
+
+  struct Node
+  {
+    unsigned id = 0;
+    std::vector<unsigned> cpus; // The ones the process may use, ascending
+  };
+
+  namespace detail
+  {
+    // Parses a kernel CPU list such as "0-3,8-11,16"
+    inline std::vector<unsigned> parseCpuList(const std::string &str)
+    {
+      std::vector<unsigned> vecCpus;
+      std::istringstream iss(str);
+      std::string strRange;
+      while (std::getline(iss, strRange, ','))
+      {
+        std::istringstream issRange(strRange);
+        unsigned uFirst = 0, uLast = 0;
+        char cDash = 0;
+        if (!(issRange >> uFirst))
+          continue;
+        if (!(issRange >> cDash >> uLast) || cDash != '-')
+          uLast = uFirst;
+        for (unsigned u = uFirst; u <= uLast; ++u)
+          vecCpus.push_back(u);
+      }
+      return vecCpus;
+    }
+
+    inline std::string readLine(const std::string &strPath)
+    {
+      std::ifstream ifs(strPath);
+      std::string strLine;
+      std::getline(ifs, strLine);
+      return strLine;
+    }
+
+    inline std::vector<unsigned> allowedCpus()
+    {
+      std::vector<unsigned> vecCpus;
+#if defined(__linux__)
+      // The mask has to be at least as large as the kernel's
+      for (int nCpus = 1024; nCpus <= (1 << 16); nCpus *= 2)
+      {
+        cpu_set_t *pSet = CPU_ALLOC(nCpus);
+        if (!pSet)
+          break;
+        const std::size_t szSet = CPU_ALLOC_SIZE(nCpus);
+        CPU_ZERO_S(szSet, pSet);
+        const bool bOk = sched_getaffinity(0, szSet, pSet) == 0;
+        const int nError = errno;
+        if (bOk)
+          for (int i = 0; i < nCpus; ++i)
+            if (CPU_ISSET_S(i, szSet, pSet))
+              vecCpus.push_back(unsigned(i));
+        CPU_FREE(pSet);
+        if (bOk || nError != EINVAL)
+          break;
+      }
+#endif
+      if (vecCpus.empty())
+        for (unsigned u = 0; u < std::max(1u, std::thread::hardware_concurrency()); ++u)
+          vecCpus.push_back(u);
+      return vecCpus;
+    }
+
+    inline std::vector<Node> detectNodes()
+    {
+      const std::vector<unsigned> vecAllowed = allowedCpus();
+      std::vector<Node> vecNodes;
+      std::size_t szListed = 0;
+      for (unsigned uNode : parseCpuList(readLine("/sys/devices/system/node/online")))
+      {
+        Node node{uNode, {}};
+        for (unsigned uCpu : parseCpuList(readLine("/sys/devices/system/node/node" + std::to_string(uNode) + "/cpulist")))
+          if (std::binary_search(vecAllowed.begin(), vecAllowed.end(), uCpu))
+            node.cpus.push_back(uCpu);
+        szListed += node.cpus.size();
+        if (!node.cpus.empty())
+          vecNodes.push_back(std::move(node));
+      }
+      // No sysfs, or it does not account for every CPU: one node of them all
+      if (szListed != vecAllowed.size())
+        vecNodes.assign(1, Node{0, vecAllowed});
+      return vecNodes;
+    }
+  }
+
+  // The nodes with at least one CPU the process may use, detected once
+  inline const std::vector<Node> &nodes()
+  {
+    static const std::vector<Node> vecNodes = detail::detectNodes();
+    return vecNodes;
+  }
+
+  // Number of CPUs the process may use. Unlike hardware_concurrency()
+  // this leaves out those the affinity mask excludes.
+  inline std::size_t cpuCount()
+  {
+    std::size_t szCount = 0;
+    for (const Node &node : nodes())
+      szCount += node.cpus.size();
+    return szCount;
+  }
+
+  // Pins the calling thread to the CPU. Returns whether that worked;
+  // where affinity is not supported it does nothing.
+  inline bool pinThisThread(unsigned cpu)
+  {
+#if defined(__linux__)
+    cpu_set_t *pSet = CPU_ALLOC(cpu + 1);
+    if (!pSet)
+      return false;
+    const std::size_t szSet = CPU_ALLOC_SIZE(cpu + 1);
+    CPU_ZERO_S(szSet, pSet);
+    CPU_SET_S(cpu, szSet, pSet);
+    const bool bOk = pthread_setaffinity_np(pthread_self(), szSet, pSet) == 0;
+    CPU_FREE(pSet);
+    return bOk;
+#else
+    (void)cpu;
+    return false;
+#endif
+  }
+
+  // Where one worker runs
+  struct Slot
+  {
+    int cpu = -1;      // -1: wherever the OS puts it
+    unsigned node = 0; // Node::id
+
+    // To be called first thing on the worker thread
+    void apply() const
+    {
+      if (cpu >= 0)
+        pinThisThread(unsigned(cpu));
+    }
+  };
+
+  // Slots of the workers of a pool, see above. Its size is the number of
+  // workers.
+  class Placement
+  {
+  public:
+    // numThreads workers placed by the OS
+    explicit Placement(std::size_t numThreads = cpuCount())
+        : _slots(std::max<std::size_t>(numThreads, 1))
+    {
+    }
+
+    // Pins the workers one per CPU, filling a node before moving on to
+    // the next, so that neighbouring workers share a node. numThreads = 0
+    // means one per CPU; with more workers than CPUs they wrap around.
+    static Placement compact(std::size_t numThreads = 0)
+    {
+      std::vector<Slot> vecCpus;
+      for (const Node &node : nodes())
+        for (unsigned uCpu : node.cpus)
+          vecCpus.push_back(Slot{int(uCpu), node.id});
+      return pinned(vecCpus, numThreads);
+    }
+
+    // Pins the workers one per CPU, dealt out to the nodes in turn, to
+    // spread memory bandwidth over all of them.
+    static Placement spread(std::size_t numThreads = 0)
+    {
+      std::vector<Slot> vecCpus;
+      for (std::size_t i = 0; vecCpus.size() < cpuCount(); ++i)
+        for (const Node &node : nodes())
+          if (i < node.cpus.size())
+            vecCpus.push_back(Slot{int(node.cpus[i]), node.id});
+      return pinned(vecCpus, numThreads);
+    }
+
+    // Pins the workers to the CPUs of one node, given by its Node::id.
+    // Throws std::invalid_argument if the process may not use any of them.
+    static Placement onNode(unsigned node, std::size_t numThreads = 0)
+    {
+      for (const Node &n : nodes())
+        if (n.id == node)
+        {
+          std::vector<Slot> vecCpus;
+          for (unsigned uCpu : n.cpus)
+            vecCpus.push_back(Slot{int(uCpu), n.id});
+          return pinned(vecCpus, numThreads);
+        }
+      throw std::invalid_argument("Topology::Placement::onNode: no usable CPU on node " + std::to_string(node));
+    }
+
+    std::size_t size() const noexcept
+    {
+      return _slots.size();
+    }
+
+    const Slot &operator[](std::size_t index) const noexcept
+    {
+      return _slots[index];
+    }
+
+    // The other workers in the order worker index should try to steal
+    // from: those on its own node first, then the rest, each group in
+    // ring order starting after index.
+    std::vector<std::size_t> victims(std::size_t index) const
+    {
+      std::vector<std::size_t> vecVictims;
+      vecVictims.reserve(_slots.size() - 1);
+      for (int bLocal = 1; bLocal >= 0; --bLocal)
+        for (std::size_t k = 1; k < _slots.size(); ++k)
+        {
+          const std::size_t i = (index + k) % _slots.size();
+          if ((_slots[i].node == _slots[index].node) == bool(bLocal))
+            vecVictims.push_back(i);
+        }
+      return vecVictims;
+    }
+
+  private:
+    static Placement pinned(const std::vector<Slot> &vecCpus, std::size_t numThreads)
+    {
+      Placement placement(numThreads ? numThreads : vecCpus.size());
+      for (std::size_t i = 0; i < placement.size(); ++i)
+        placement._slots[i] = vecCpus[i % vecCpus.size()];
+      return placement;
+    }
+
+    std::vector<Slot> _slots;
+  };
+
+} // namespace Topology
+
+#endif // TOPOLOGY_H
@@ -62,6 +62,14 @@
 #include <exception>
 #include <stdexcept>
 #include <concepts>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
 
 namespace std {
 template<class A, class B>
@@ -182,6 +190,208 @@ void bulk_execute(Ex ex, Op op, size_t n, SF sf, C c) {
       }));
 }
 
+// A fixed-size pool of threads whose executor has a real
+// bulk_execute: [0, n) is split into one chunk per worker, all
+// chunks share the state made by sf(), and the last chunk to
+// finish hands that state on to the continuation.
+class thread_pool {
+  struct __task {
+    __task* next_ = nullptr;
+    void (*run_)(__task*) noexcept = nullptr;
+  };
+
+  template<class C>
+  struct __execute_task : __task {
+    C c_;
+    explicit __execute_task(C c) : c_((C&&) c) {
+      this->run_ = &__run;
+    }
+    static void __run(__task* t) noexcept {
+      unique_ptr<__execute_task> self{static_cast<__execute_task*>(t)};
+      invoke_callback((C&&) self->c_);
+    }
+  };
+
+  // One allocation per bulk job: the shared state, the
+  // continuation and, right behind them, the chunk tasks.
+  template<class Op, class State, class C>
+  struct __bulk_state {
+    struct __chunk : __task {
+      __bulk_state* state_ = nullptr;
+      size_t begin_ = 0, end_ = 0;
+    };
+    static_assert(is_trivially_destructible_v<__chunk>);
+
+    struct __deleter {
+      void operator()(__bulk_state* p) const noexcept {
+        p->~__bulk_state();
+        ::operator delete(p, align_val_t{alignof(__bulk_state)});
+      }
+    };
+    using __ptr = unique_ptr<__bulk_state, __deleter>;
+
+    Op op_;
+    State shared_;
+    C c_;
+    atomic<size_t> remaining_;
+    atomic<bool> failed_{false};
+    exception_ptr error_;
+
+    static __ptr __make(Op op, State shared, C c, size_t n, size_t chunks) {
+      static_assert(sizeof(__bulk_state) % alignof(__chunk) == 0);
+      void* p = ::operator new(sizeof(__bulk_state) + chunks * sizeof(__chunk),
+                               align_val_t{alignof(__bulk_state)});
+      try {
+        return __ptr{::new(p) __bulk_state{
+          (Op&&) op, (State&&) shared, (C&&) c, n, chunks}};
+      } catch(...) {
+        ::operator delete(p, align_val_t{alignof(__bulk_state)});
+        throw;
+      }
+    }
+
+    __chunk* __chunks() noexcept {
+      return launder(reinterpret_cast<__chunk*>(this + 1));
+    }
+
+  private:
+    __bulk_state(Op op, State shared, C c, size_t n, size_t chunks)
+      : op_((Op&&) op)
+      , shared_((State&&) shared)
+      , c_((C&&) c)
+      , remaining_(chunks) {
+      auto* first = reinterpret_cast<__chunk*>(this + 1);
+      for(size_t k = 0; k < chunks; ++k) {
+        __chunk* chunk = ::new(static_cast<void*>(first + k)) __chunk{};
+        chunk->run_ = &__run;
+        chunk->state_ = this;
+        chunk->begin_ = n * k / chunks;
+        chunk->end_ = n * (k + 1) / chunks;
+        chunk->next_ = k + 1 < chunks ? &first[k + 1] : nullptr;
+      }
+    }
+
+  public:
+
+    static void __run(__task* t) noexcept {
+      auto& chunk = *static_cast<__chunk*>(t);
+      __bulk_state* self = chunk.state_;
+      try {
+        for(size_t i = chunk.begin_; i < chunk.end_; ++i)
+          invoke(self->op_, i, self->shared_);
+      } catch(...) {
+        if(!self->failed_.exchange(true, memory_order_relaxed))
+          self->error_ = current_exception();
+      }
+      // Countdown latch: whoever brings it to zero completes the job
+      if(self->remaining_.fetch_sub(1, memory_order_acq_rel) == 1)
+        self->__complete();
+    }
+
+    void __complete() noexcept {
+      __ptr self{this};
+      if(!error_)
+        invoke_callback((C&&) c_, (State&&) shared_);
+      else if constexpr (CallbackSignal<C>)
+        ((C&&) c_).error(move(error_));
+      else
+        terminate();
+    }
+  };
+
+public:
+  class executor_type {
+    friend thread_pool;
+    thread_pool* pool_;
+    explicit executor_type(thread_pool* pool) noexcept : pool_(pool) {}
+  public:
+    template<Invocable C>
+    void execute(C c) const {
+      auto* t = new __execute_task<C>{(C&&) c};
+      pool_->__push(t, t);
+    }
+
+    template<Invocable SF,
+      class State = decay_t<invoke_result_t<SF&>>,
+      Invocable<size_t, State&> Op, Invocable<State> C>
+    void bulk_execute(Op op, size_t n, SF sf, C c) const {
+      using __state_t = __bulk_state<Op, State, C>;
+      const size_t chunks = max<size_t>(min(n, pool_->size()), 1);
+      auto state = __state_t::__make((Op&&) op, sf(), (C&&) c, n, chunks);
+      pool_->__push(&state->__chunks()[0], &state->__chunks()[chunks - 1]);
+      state.release(); // The last chunk deletes it
+    }
+
+    friend bool operator==(executor_type, executor_type) = default;
+  };
+
+  explicit thread_pool(size_t num_threads = thread::hardware_concurrency()) {
+    num_threads = max<size_t>(num_threads, 1);
+    threads_.reserve(num_threads);
+    for(size_t i = 0; i < num_threads; ++i)
+      threads_.emplace_back([this] { __work(); });
+  }
+
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
+
+  // Runs whatever is still queued, then joins the workers
+  ~thread_pool() {
+    {
+      lock_guard lock{mutex_};
+      stop_ = true;
+    }
+    cv_.notify_all();
+    for(auto& t : threads_)
+      t.join();
+  }
+
+  executor_type executor() noexcept {
+    return executor_type{this};
+  }
+
+  size_t size() const noexcept {
+    return threads_.size();
+  }
+
+private:
+  // Queues the already linked tasks [first, last]
+  void __push(__task* first, __task* last) {
+    {
+      lock_guard lock{mutex_};
+      *tail_ = first;
+      tail_ = &last->next_;
+    }
+    if(first == last)
+      cv_.notify_one();
+    else
+      cv_.notify_all();
+  }
+
+  void __work() {
+    for(;;) {
+      __task* t;
+      {
+        unique_lock lock{mutex_};
+        cv_.wait(lock, [this] { return head_ || stop_; });
+        if(!head_)
+          return;
+        t = head_;
+        if(!(head_ = t->next_))
+          tail_ = &head_;
+      }
+      t->run_(t);
+    }
+  }
+
+  mutex mutex_;
+  condition_variable cv_;
+  __task* head_ = nullptr;
+  __task** tail_ = &head_;
+  bool stop_ = false;
+  vector<thread> threads_;
+};
+
 }} // namespace std::tbd
 
 //
@@ -409,6 +619,18 @@ void foo4() {
                            [](string&&)noexcept{});          // Continuation
 }
 
+// bulk_execute on a thread_pool runs the iterations in parallel,
+// one chunk per worker:
+void foo5() {
+    std::tbd::thread_pool pool{4};
+
+    std::tbd::bulk_execute(pool.executor(),                                   // Executor
+                           [](std::size_t i, std::vector<int>& v)noexcept{ v[i] = int(i); }, // Bulk operation
+                           100u,                                              // Iterations
+                           []{ return std::vector<int>(100); },               // State factory
+                           [](std::vector<int>&&)noexcept{});                 // Continuation
+}
+
 template<typename Func, typename Inner>
 struct transform_sender {
     Inner inner_;
@@ -0,0 +1,183 @@
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Topology.h"
+
+// Microbenchmark helpers for the bench target. Every measurement is one
+// JSON object on a line of its own on stdout, e.g.
+//   {"bench":"thread_pool.post","threads":4,"task":"empty","ops":200000,
+//    "reps":5,"median_ns":1.2e7,"min_ns":1.1e7,"ns_per_op":60.1,"ops_per_s":1.66e7}
+// so runs can be diffed or loaded into anything that reads JSON lines.
+// The body of a benchmark runs once to warm up and then reps times; the
+// median and the minimum over the reps are reported.
+
+namespace Bench
+{
+    using Clock = std::chrono::steady_clock;
+
+    // A key with either a number or a string value
+    struct Field
+    {
+        Field(std::string_view key, double number) : key{key}, number{number} {}
+        Field(std::string_view key, int number) : key{key}, number{double(number)} {}
+        Field(std::string_view key, std::size_t number) : key{key}, number{double(number)} {}
+        Field(std::string_view key, std::string_view text) : key{key}, text{text}, isText{true} {}
+
+        std::string_view key;
+        double number = 0;
+        std::string_view text;
+        bool isText = false;
+    };
+
+    class Runner
+    {
+    public:
+        Runner(std::string filter, int reps) : m_filter{std::move(filter)}, m_reps{std::max(reps, 1)} {}
+
+        // Whether benchmarks named so should run: all do without a filter,
+        // otherwise those whose name contains it
+        bool enabled(std::string_view name) const
+        {
+            return m_filter.empty() || name.find(m_filter) != std::string_view::npos;
+        }
+
+        int reps() const { return m_reps; }
+
+        // Runs body() once to warm up, then reps times, and returns the
+        // nanoseconds each of those took, sorted
+        template <typename F>
+        std::vector<double> time(F &&body) const
+        {
+            body();
+            std::vector<double> ns;
+            for (int i = 0; i < m_reps; ++i)
+            {
+                const auto start = Clock::now();
+                body();
+                ns.push_back(std::chrono::duration<double, std::nano>(Clock::now() - start).count());
+            }
+            std::sort(ns.begin(), ns.end());
+            return ns;
+        }
+
+        // Like time(), for bodies that measure only part of themselves and
+        // return the nanoseconds that count
+        template <typename F>
+        std::vector<double> timeParts(F &&body) const
+        {
+            body();
+            std::vector<double> ns;
+            for (int i = 0; i < m_reps; ++i)
+                ns.push_back(body());
+            std::sort(ns.begin(), ns.end());
+            return ns;
+        }
+
+        // ops is the amount of work done by one run of the body, in units
+        // of unit; bytes also get "mb_per_s"
+        void report(std::string_view name, std::initializer_list<Field> params, double ops,
+                    const std::vector<double> &ns, std::string_view unit = "op") const
+        {
+            const double median = ns[ns.size() / 2];
+            std::string line = "{\"bench\":\"" + std::string{name} + "\"";
+            for (const Field &field : params)
+                append(line, field);
+            append(line, {"unit", unit});
+            append(line, {"ops", ops});
+            append(line, {"reps", int(ns.size())});
+            append(line, {"median_ns", median});
+            append(line, {"min_ns", ns.front()});
+            append(line, {"ns_per_op", median / ops});
+            append(line, {"ops_per_s", ops * 1e9 / median});
+            if (unit == "byte")
+                append(line, {"mb_per_s", ops * 1e9 / median / (1 << 20)});
+            line += "}\n";
+            std::fputs(line.c_str(), stdout);
+            std::fflush(stdout);
+        }
+
+    private:
+        static void append(std::string &line, const Field &field)
+        {
+            char buffer[64];
+            line += ",\"";
+            line += field.key;
+            line += "\":";
+            if (field.isText)
+            {
+                line += '"';
+                line += field.text;
+                line += '"';
+            }
+            else
+            {
+                std::snprintf(buffer, sizeof buffer, "%.6g", field.number);
+                line += buffer;
+            }
+        }
+
+        std::string m_filter;
+        int m_reps;
+    };
+
+    // 1, 2, 4, ... up to the number of usable CPUs, which is always included
+    inline std::vector<std::size_t> threadCounts()
+    {
+        const std::size_t cores = Topology::cpuCount();
+        std::vector<std::size_t> counts;
+        for (std::size_t n = 1; n < cores; n *= 2)
+            counts.push_back(n);
+        counts.push_back(cores);
+        return counts;
+    }
+
+    // Keeps the compiler from optimising value, and what produced it, away
+    template <typename T>
+    inline void keep(const T &value)
+    {
+        asm volatile("" : : "r,m"(value) : "memory");
+    }
+
+    // cost steps of dependent integer work, roughly a nanosecond each
+    inline std::uint64_t spin(std::uint64_t cost) noexcept
+    {
+        std::uint64_t x = cost;
+        for (std::uint64_t i = 0; i < cost; ++i)
+        {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+            asm volatile("" : "+r"(x));
+        }
+        return x;
+    }
+
+    // Until counter reaches target
+    inline void waitFor(const std::atomic<std::size_t> &counter, std::size_t target)
+    {
+        while (counter.load(std::memory_order_acquire) < target)
+            std::this_thread::yield();
+    }
+
+    // The suites, one per translation unit, since the demo sources they
+    // include do not all go together in one
+    void threadPoolSuite(const Runner &runner);
+    void lazySuite(const Runner &runner);
+    void moThreadSuite(const Runner &runner);
+    void executionContextSuite(const Runner &runner);
+#if defined(BENCH_HAVE_CPPCORO)
+    void countLinesSuite(const Runner &runner);
+#endif
+} // namespace Bench
+
+#endif // BENCH_H
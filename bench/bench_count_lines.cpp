@@ -0,0 +1,64 @@
+#include "Bench.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <string>
+
+#include "fs_read.cpp"
+#include <cppcoro/sync_wait.hpp>
+
+namespace Bench
+{
+    namespace
+    {
+        constexpr std::size_t FileSize = std::size_t(64) << 20;
+        constexpr std::size_t LineLength = 64;
+
+        // FileSize bytes of LineLength-byte lines, in the temp directory
+        std::filesystem::path makeFile()
+        {
+            const auto path = std::filesystem::temp_directory_path() / "coroutine_cplus_bench_lines.txt";
+            std::string line(LineLength - 1, 'x');
+            line += '\n';
+            std::FILE *file = std::fopen(path.c_str(), "wb");
+            for (std::size_t written = 0; written < FileSize; written += line.size())
+                std::fwrite(line.data(), 1, line.size(), file);
+            std::fclose(file);
+            return path;
+        }
+
+        cppcoro::task<std::uint64_t> countLines(cppcoro::io_service &ioService, const std::filesystem::path &path,
+                                                BufferPool &buffers, read_mode mode)
+        {
+            std::uint64_t lines = 0;
+            co_await scan_file(ioService, fs::path{path.native()}, buffers, [&](const std::uint8_t *data, std::size_t size) {
+                lines += ByteScan::count(data, size, '\n');
+            }, 0, std::numeric_limits<std::uint64_t>::max(), mode);
+            co_return lines;
+        }
+
+        // Throughput of one file's line count from the page cache, which
+        // the warm-up run fills, read with async reads or mapped.
+        // eventThreads keeps the service running for all the reps; a work
+        // scope per count would stop it when the first one ends.
+        void countLinesThroughput(const Runner &runner)
+        {
+            const auto path = makeFile();
+            cppcoro::io_service ioService;
+            io_event_threads eventThreads{ioService};
+            BufferPool buffers;
+            for (auto [mode, name] : {std::pair{read_mode::async_read, "async_read"}, std::pair{read_mode::mapped, "mapped"}})
+            {
+                const auto ns = runner.time([&] { keep(cppcoro::sync_wait(countLines(ioService, path, buffers, mode))); });
+                runner.report("fs.count_lines", {{"mode", name}, {"kernel", ByteScan::kernelName()}}, FileSize, ns, "byte");
+            }
+            std::filesystem::remove(path);
+        }
+    } // namespace
+
+    void countLinesSuite(const Runner &runner)
+    {
+        if (runner.enabled("fs.count_lines"))
+            countLinesThroughput(runner);
+    }
+} // namespace Bench
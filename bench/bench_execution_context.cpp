@@ -0,0 +1,76 @@
+#include "Bench.h"
+
+#include "some_prop.cpp"
+
+namespace Bench
+{
+    namespace
+    {
+        constexpr std::size_t Coroutines = 100000;
+        constexpr std::size_t Hops = 1000000;
+
+        struct detached
+        {
+            struct promise_type
+            {
+                detached get_return_object() noexcept { return {}; }
+                std::suspend_never initial_suspend() noexcept { return {}; }
+                std::suspend_never final_suspend() noexcept { return {}; }
+                void return_void() noexcept {}
+                void unhandled_exception() noexcept { std::terminate(); }
+            };
+        };
+
+        detached hop(simple_execution_context &ctx, std::size_t hops, std::atomic<std::size_t> &done)
+        {
+            auto scheduler = ctx.get_scheduler();
+            for (std::size_t i = 0; i < hops; ++i)
+                co_await scheduler.schedule();
+            done.fetch_add(1, std::memory_order_release);
+        }
+
+        // Coroutines scheduled from outside onto threads blocked in run()
+        void scheduleThroughput(const Runner &runner)
+        {
+            for (std::size_t threads : threadCounts())
+            {
+                simple_execution_context ctx;
+                std::vector<std::thread> runners;
+                for (std::size_t i = 0; i < threads; ++i)
+                    runners.emplace_back([&ctx] { ctx.run(); });
+                std::atomic<std::size_t> done{0};
+                const auto ns = runner.time([&] {
+                    done.store(0);
+                    for (std::size_t i = 0; i < Coroutines; ++i)
+                        hop(ctx, 1, done);
+                    waitFor(done, Coroutines);
+                });
+                ctx.stop();
+                for (auto &thread : runners)
+                    thread.join();
+                runner.report("exec_context.schedule.throughput", {{"threads", threads}}, Coroutines, ns);
+            }
+        }
+
+        // One coroutine rescheduling itself while the context is drained:
+        // the symmetric-transfer path
+        void drainHopLatency(const Runner &runner)
+        {
+            simple_execution_context ctx;
+            std::atomic<std::size_t> done{0};
+            const auto ns = runner.time([&] {
+                hop(ctx, Hops, done);
+                ctx.drain();
+            });
+            runner.report("exec_context.drain.hop.latency", {}, Hops, ns);
+        }
+    } // namespace
+
+    void executionContextSuite(const Runner &runner)
+    {
+        if (runner.enabled("exec_context.schedule.throughput"))
+            scheduleThroughput(runner);
+        if (runner.enabled("exec_context.drain.hop.latency"))
+            drainHopLatency(runner);
+    }
+} // namespace Bench
@@ -0,0 +1,100 @@
+#include "Bench.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "Lazy.h"
+
+namespace Bench
+{
+    namespace
+    {
+        constexpr std::size_t Tasks = 200000;
+        constexpr std::uint64_t SmallTaskCost = 200;
+        constexpr std::size_t Elements = 1 << 16;
+
+        void postThroughput(const Runner &runner, const char *task, std::uint64_t cost)
+        {
+            for (std::size_t threads : threadCounts())
+            {
+                Lazy::Pool pool{threads};
+                std::atomic<std::size_t> done{0};
+                const auto ns = runner.time([&] {
+                    done.store(0);
+                    for (std::size_t i = 0; i < Tasks; ++i)
+                        pool.post([&done, cost] {
+                            keep(spin(cost));
+                            done.fetch_add(1, std::memory_order_release);
+                        });
+                    waitFor(done, Tasks);
+                });
+                runner.report("lazy.pool.post.throughput", {{"threads", threads}, {"task", task}}, Tasks, ns);
+            }
+        }
+
+        // runForAll over Elements elements on a pool, the calling thread
+        // included, as the work per element grows
+        void runForAllScaling(const Runner &runner)
+        {
+            const std::vector<std::uint64_t> vecX(Elements, 1);
+            for (std::uint64_t cost : {0, 16, 256, 4096})
+                for (std::size_t threads : threadCounts())
+                {
+                    Lazy::Pool pool{std::max<std::size_t>(threads - 1, 1)};
+                    auto func = [cost](std::uint64_t x) { return spin(cost) + x; };
+                    const auto ns = runner.time([&] {
+                        if (threads == 1)
+                            keep(Lazy::runForAll<1>(pool, vecX, Lazy::Partition::guided(), func));
+                        else
+                            keep(Lazy::runForAll(pool, vecX, Lazy::Partition::guided(), func));
+                    });
+                    runner.report("lazy.run_for_all", {{"threads", threads}, {"cost", std::size_t(cost)}}, Elements, ns);
+                }
+        }
+
+        // runForAll whose function runs another runForAll on the same pool,
+        // shares of the outer loop being run by the workers and the caller
+        // alike. Also checks the result, since a nested fork that is not run
+        // inline hangs or loses shares.
+        void runForAllNested(const Runner &runner)
+        {
+            constexpr std::size_t Outer = 64;
+            const std::vector<std::uint64_t> vecOuter(Outer, 1), vecInner(Elements / Outer, 1);
+            for (std::size_t threads : threadCounts())
+            {
+                Lazy::Pool pool{std::max<std::size_t>(threads - 1, 1)};
+                auto inner = [](std::uint64_t x) { return spin(16) + x; };
+                auto outer = [&](std::uint64_t x) {
+                    std::uint64_t sum = 0;
+                    for (std::uint64_t y : Lazy::runForAll(pool, vecInner, inner))
+                        sum += y;
+                    return sum * x;
+                };
+                const auto ns = runner.time([&] {
+                    std::uint64_t sum = 0;
+                    for (std::uint64_t y : Lazy::runForAll(pool, vecOuter, outer))
+                        sum += y;
+                    if (sum != (spin(16) + 1) * Elements)
+                    {
+                        std::fprintf(stderr, "lazy.run_for_all.nested: wrong result %llu\n", (unsigned long long)sum);
+                        std::exit(1);
+                    }
+                });
+                runner.report("lazy.run_for_all.nested", {{"threads", threads}}, Elements, ns);
+            }
+        }
+    } // namespace
+
+    void lazySuite(const Runner &runner)
+    {
+        if (runner.enabled("lazy.pool.post.throughput"))
+        {
+            postThroughput(runner, "empty", 0);
+            postThroughput(runner, "small", SmallTaskCost);
+        }
+        if (runner.enabled("lazy.run_for_all"))
+            runForAllScaling(runner);
+        if (runner.enabled("lazy.run_for_all.nested"))
+            runForAllNested(runner);
+    }
+} // namespace Bench
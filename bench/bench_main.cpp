@@ -0,0 +1,34 @@
+#include "Bench.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// Usage: bench [--filter=<part of a benchmark name>] [--reps=<n>]
+int main(int argc, char **argv)
+{
+    std::string filter;
+    int reps = 5;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (std::strncmp(argv[i], "--filter=", 9) == 0)
+            filter = argv[i] + 9;
+        else if (std::strncmp(argv[i], "--reps=", 7) == 0)
+            reps = std::atoi(argv[i] + 7);
+        else
+        {
+            std::fprintf(stderr, "usage: %s [--filter=<name>] [--reps=<n>]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
+    const Bench::Runner runner{filter, reps};
+    Bench::threadPoolSuite(runner);
+    Bench::lazySuite(runner);
+    Bench::moThreadSuite(runner);
+    Bench::executionContextSuite(runner);
+#if defined(BENCH_HAVE_CPPCORO)
+    Bench::countLinesSuite(runner);
+#endif
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,62 @@
+#include "Bench.h"
+
+#define NO_DEMO_MAIN
+#include "mo_thread_pool.cpp"
+
+namespace Bench
+{
+    namespace
+    {
+        constexpr std::size_t Hops = 100000;
+        constexpr std::size_t Coroutines = 100000;
+
+        Task<> pingPong(Thread &a, Thread &b, std::size_t rounds)
+        {
+            for (std::size_t i = 0; i < rounds; ++i)
+            {
+                co_await a;
+                co_await b;
+            }
+        }
+
+        // One coroutine going back and forth between two Threads: each
+        // hop is a queue push, a wake-up and a resume on the other side
+        void threadHopLatency(const Runner &runner)
+        {
+            Thread a, b;
+            const auto ns = runner.time([&] { sync_wait(pingPong(a, b, Hops / 2)); });
+            runner.report("mo.thread.hop.latency", {}, Hops, ns);
+        }
+
+        task hopOnce(CoroThreadPool &pool, std::atomic<std::size_t> &done)
+        {
+            co_await pool.schedule();
+            done.fetch_add(1, std::memory_order_release);
+        }
+
+        // Coroutines started from outside, each hopping onto the pool once
+        void poolScheduleThroughput(const Runner &runner)
+        {
+            for (std::size_t threads : threadCounts())
+            {
+                CoroThreadPool pool{threads};
+                std::atomic<std::size_t> done{0};
+                const auto ns = runner.time([&] {
+                    done.store(0);
+                    for (std::size_t i = 0; i < Coroutines; ++i)
+                        hopOnce(pool, done);
+                    waitFor(done, Coroutines);
+                });
+                runner.report("mo.pool.schedule.throughput", {{"threads", threads}}, Coroutines, ns);
+            }
+        }
+    } // namespace
+
+    void moThreadSuite(const Runner &runner)
+    {
+        if (runner.enabled("mo.thread.hop.latency"))
+            threadHopLatency(runner);
+        if (runner.enabled("mo.pool.schedule.throughput"))
+            poolScheduleThroughput(runner);
+    }
+} // namespace Bench
@@ -0,0 +1,65 @@
+#include "Bench.h"
+
+#define NO_DEMO_MAIN
+#include "thread_pool.cpp"
+
+namespace Bench
+{
+    namespace
+    {
+        constexpr std::size_t Tasks = 200000;
+        constexpr std::uint64_t SmallTaskCost = 200;
+
+        // Caller-side cost of ThreadPool::post, with every core draining
+        void postLatency(const Runner &runner)
+        {
+            const std::size_t threads = Topology::cpuCount();
+            ThreadPool pool{threads};
+            std::atomic<std::size_t> done{0};
+            const auto ns = runner.timeParts([&] {
+                done.store(0);
+                const auto start = Clock::now();
+                for (std::size_t i = 0; i < Tasks; ++i)
+                    pool.post([&done] { done.fetch_add(1, std::memory_order_release); });
+                const auto end = Clock::now();
+                waitFor(done, Tasks);
+                return std::chrono::duration<double, std::nano>(end - start).count();
+            });
+            runner.report("thread_pool.post.latency", {{"threads", threads}}, Tasks, ns);
+        }
+
+        // Tasks posted from outside and run to completion, per second, with
+        // the workers placed by the OS and pinned node by node
+        void throughput(const Runner &runner, const char *task, std::uint64_t cost)
+        {
+            for (std::size_t threads : threadCounts())
+                for (const bool pinned : {false, true})
+                {
+                    ThreadPool pool{pinned ? Topology::Placement::compact(threads) : Topology::Placement(threads)};
+                    std::atomic<std::size_t> done{0};
+                    const auto ns = runner.time([&] {
+                        done.store(0);
+                        for (std::size_t i = 0; i < Tasks; ++i)
+                            pool.post([&done, cost] {
+                                keep(spin(cost));
+                                done.fetch_add(1, std::memory_order_release);
+                            });
+                        waitFor(done, Tasks);
+                    });
+                    runner.report("thread_pool.post.throughput",
+                                  {{"threads", threads}, {"task", task}, {"placement", pinned ? "compact" : "os"}}, Tasks, ns);
+                }
+        }
+    } // namespace
+
+    void threadPoolSuite(const Runner &runner)
+    {
+        if (runner.enabled("thread_pool.post.latency"))
+            postLatency(runner);
+        if (runner.enabled("thread_pool.post.throughput"))
+        {
+            throughput(runner, "empty", 0);
+            throughput(runner, "small", SmallTaskCost);
+        }
+    }
+} // namespace Bench
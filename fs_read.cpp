@@ -1,34 +1,585 @@
 #include <cppcoro/task.hpp>
+#include <cppcoro/async_scope.hpp>
 #include <cppcoro/io_service.hpp>
 #include <cppcoro/read_only_file.hpp>
 #include <cppcoro/filesystem.hpp>
+#include <cppcoro/single_consumer_event.hpp>
+#include <cppcoro/when_all_ready.hpp>
 #include <memory>
 #include <algorithm>
+#include <atomic>
+#include <coroutine>
+#include <exception>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <optional>
+#include <system_error>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define FS_READ_HAVE_MMAP 1
+#else
+#define FS_READ_HAVE_MMAP 0
+#endif
+
+#include "ByteScan.h"
+#include "Topology.h"
 
 namespace fs = cppcoro::filesystem;
 
-cppcoro::task<std::uint64_t> count_lines(cppcoro::io_service &ioService, fs::path path)
+// Fixed set of read buffers for the read-ahead pipeline, each with the
+// bookkeeping of the read it is used for. It is allocated once and can be
+// reused for any number of files, one file at a time.
+class BufferPool
 {
-  auto file = cppcoro::read_only_file::open(ioService, path);
-  constexpr size_t bufferSize = 4096;
-  auto buffer = std::make_unique<std::uint8_t[]>(bufferSize);
-  std::uint64_t newlineCount = 0;
-  for (std::uint64_t offset = 0, fileSize = file.size(); offset < fileSize;)
+public:
+  struct Slot
+  {
+    std::uint8_t *data = nullptr;
+    std::size_t bytesRead = 0;
+    std::exception_ptr error;
+    cppcoro::single_consumer_event ready;
+  };
+
+  explicit BufferPool(std::size_t bufferSize = 512 * 1024, std::size_t count = 4)
+      : _bufferSize{std::max<std::size_t>(bufferSize, 1)},
+        _count{std::max<std::size_t>(count, 1)},
+        _storage{std::make_unique<std::uint8_t[]>(_bufferSize * _count)},
+        _slots{std::make_unique<Slot[]>(_count)}
+  {
+    for (std::size_t i = 0; i < _count; ++i)
+      _slots[i].data = _storage.get() + i * _bufferSize;
+  }
+
+  BufferPool(const BufferPool &) = delete;
+
+  std::size_t buffer_size() const noexcept { return _bufferSize; }
+  std::size_t size() const noexcept { return _count; }
+  Slot &slot(std::size_t i) noexcept { return _slots[i % _count]; }
+
+private:
+  std::size_t _bufferSize;
+  std::size_t _count;
+  std::unique_ptr<std::uint8_t[]> _storage;
+  std::unique_ptr<Slot[]> _slots;
+};
+
+// Reads [offset, offset + size) into the slot and signals it, also on error
+cppcoro::task<> read_chunk(cppcoro::read_only_file &file, std::uint64_t offset, std::size_t size, BufferPool::Slot &slot)
+{
+  slot.bytesRead = 0;
+  slot.error = nullptr;
+  try
+  {
+    while (slot.bytesRead < size)
+    {
+      const auto bytesRead = co_await file.read(offset + slot.bytesRead, slot.data + slot.bytesRead, size - slot.bytesRead);
+      if (bytesRead == 0)
+        break;
+      slot.bytesRead += bytesRead;
+    }
+  }
+  catch (...)
   {
-    const auto bytesToRead = static_cast<size_t>(
-        std::min<std::uint64_t>(bufferSize, fileSize - offset));
-    const auto bytesRead = co_await file.read(offset, buffer.get(), bytesToRead);
-    newlineCount += std::count(buffer.get(), buffer.get() + bytesRead, '\n');
-    offset += bytesRead;
+    slot.error = std::current_exception();
   }
+  slot.ready.set();
+}
+
+// Streams the file, or its byte range [begin, end), through the buffer pool:
+// one read per buffer is kept in flight, and onChunk(data, size) is called
+// for each chunk in file order while the reads of the following ones
+// proceed. A buffer is read into again as soon as onChunk has returned for it.
+template <class OnChunk>
+cppcoro::task<> read_chunks(cppcoro::io_service &ioService, fs::path path, BufferPool &buffers, OnChunk onChunk,
+                            std::uint64_t begin = 0, std::uint64_t end = std::numeric_limits<std::uint64_t>::max())
+{
+  auto file = cppcoro::read_only_file::open(
+      ioService, path, cppcoro::file_share_mode::read, cppcoro::file_buffering_mode::sequential);
+  const std::uint64_t fileSize = std::min(end, file.size());
+  begin = std::min(begin, fileSize);
+  const std::uint64_t chunkSize = buffers.buffer_size();
+  const std::uint64_t numChunks = (fileSize - begin + chunkSize - 1) / chunkSize;
+  const std::uint64_t depth = std::min<std::uint64_t>(buffers.size(), numChunks);
+
+  cppcoro::async_scope scope;
+  auto issue = [&](std::uint64_t i) {
+    auto &slot = buffers.slot(i);
+    slot.ready.reset();
+    const std::uint64_t offset = begin + i * chunkSize;
+    scope.spawn(read_chunk(file, offset, static_cast<std::size_t>(std::min(chunkSize, fileSize - offset)), slot));
+  };
+
+  for (std::uint64_t i = 0; i < depth; ++i)
+    issue(i);
+
+  std::exception_ptr error;
+  for (std::uint64_t i = 0; i < numChunks && !error; ++i)
+  {
+    auto &slot = buffers.slot(i);
+    co_await slot.ready;
+    try
+    {
+      if (slot.error)
+        std::rethrow_exception(slot.error);
+      onChunk(static_cast<const std::uint8_t *>(slot.data), slot.bytesRead);
+      if (i + depth < numChunks)
+        issue(i + depth);
+    }
+    catch (...)
+    {
+      error = std::current_exception();
+    }
+  }
+  // Reads still in flight write into the buffers: let them land first
+  co_await scope.join();
+  if (error)
+    std::rethrow_exception(error);
+}
+
+// How scan_file gets at the bytes of a file
+enum class read_mode
+{
+  automatic,  // mapped when the file is big and already in the page cache
+  async_read, // read_chunks through the io_service
+  mapped,     // mapped_file, where the platform has mmap
+};
+
+#if FS_READ_HAVE_MMAP
+
+// Read-only memory mapping of a file, or of its byte range [begin, end).
+// Cached data is then read in place, without a copy or a syscall per chunk.
+class mapped_file
+{
+public:
+  mapped_file(const fs::path &path, std::uint64_t begin = 0, std::uint64_t end = std::numeric_limits<std::uint64_t>::max())
+  {
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), path.string());
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), path.string());
+    }
+    end = std::min<std::uint64_t>(end, static_cast<std::uint64_t>(st.st_size));
+    begin = std::min(begin, end);
+    // mmap wants a page-aligned offset: map from the page holding begin
+    const std::uint64_t mapBegin = begin - begin % page_size();
+    _mappedSize = static_cast<std::size_t>(end - mapBegin);
+    _size = static_cast<std::size_t>(end - begin);
+    if (_size > 0)
+    {
+      _base = ::mmap(nullptr, _mappedSize, PROT_READ, MAP_SHARED, fd, static_cast<off_t>(mapBegin));
+      if (_base == MAP_FAILED)
+      {
+        const int error = errno;
+        ::close(fd);
+        throw std::system_error(error, std::generic_category(), path.string());
+      }
+      // Hints only: read-ahead for a front-to-back scan, and huge pages
+      // where the file system can back the mapping with them
+      ::madvise(_base, _mappedSize, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+      ::madvise(_base, _mappedSize, MADV_HUGEPAGE);
+#endif
+      _data = static_cast<const std::uint8_t *>(_base) + (begin - mapBegin);
+    }
+    ::close(fd); // The mapping keeps the file
+  }
+
+  mapped_file(const mapped_file &) = delete;
+
+  ~mapped_file()
+  {
+    if (_base != MAP_FAILED)
+      ::munmap(_base, _mappedSize);
+  }
+
+  const std::uint8_t *data() const noexcept { return _data; }
+  std::size_t size() const noexcept { return _size; }
+
+  // Share of the mapping found in the page cache, from up to `samples`
+  // pages spread evenly over it
+  double resident_fraction(std::size_t samples = 64) const
+  {
+    if (_base == MAP_FAILED)
+      return 1.0;
+    const std::size_t numPages = (_mappedSize + page_size() - 1) / page_size();
+    samples = std::max<std::size_t>(std::min(samples, numPages), 1);
+    std::size_t resident = 0;
+    for (std::size_t i = 0; i < samples; ++i)
+    {
+      unsigned char vec = 0;
+      auto page = static_cast<std::uint8_t *>(_base) + (i * numPages / samples) * page_size();
+      if (::mincore(page, 1, &vec) == 0 && (vec & 1))
+        ++resident;
+    }
+    return double(resident) / double(samples);
+  }
+
+  // Calls onChunk(data, size) for consecutive chunks of the mapping, and
+  // asks the kernel to fault in the chunk `ahead` positions further on
+  // while the current one is handled
+  template <class OnChunk>
+  void for_each_chunk(std::size_t chunkSize, std::size_t ahead, OnChunk &&onChunk) const
+  {
+    chunkSize = std::max<std::size_t>(chunkSize, 1);
+    for (std::size_t i = 0; i < ahead; ++i)
+      prefetch(i * chunkSize, chunkSize);
+    for (std::size_t offset = 0; offset < _size; offset += chunkSize)
+    {
+      prefetch(offset + ahead * chunkSize, chunkSize);
+      onChunk(_data + offset, std::min(chunkSize, _size - offset));
+    }
+  }
+
+  static std::size_t page_size() noexcept
+  {
+    static const std::size_t size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+  }
+
+private:
+  void prefetch(std::size_t offset, std::size_t length) const noexcept
+  {
+    if (offset >= _size)
+      return;
+    length = std::min(length, _size - offset);
+    auto start = reinterpret_cast<std::uintptr_t>(_data + offset);
+    const std::uintptr_t aligned = start - start % page_size();
+    ::madvise(reinterpret_cast<void *>(aligned), length + (start - aligned), MADV_WILLNEED);
+  }
+
+  void *_base = MAP_FAILED;
+  std::size_t _mappedSize = 0;
+  const std::uint8_t *_data = nullptr;
+  std::size_t _size = 0;
+};
+
+#endif
+
+// Below this a file is read, not mapped: setting up and tearing down the
+// mapping would cost more than the copy
+constexpr std::uint64_t mmap_min_size = 1 << 20;
+
+// Same contract as read_chunks, but in automatic mode a file (range) of at
+// least mmap_min_size whose pages are nearly all in the page cache is
+// mapped and scanned in place, in chunks of the pool's buffer size; other
+// files are read with read_chunks.
+template <class OnChunk>
+cppcoro::task<> scan_file(cppcoro::io_service &ioService, fs::path path, BufferPool &buffers, OnChunk onChunk,
+                          std::uint64_t begin = 0, std::uint64_t end = std::numeric_limits<std::uint64_t>::max(),
+                          read_mode mode = read_mode::automatic)
+{
+#if FS_READ_HAVE_MMAP
+  if (mode == read_mode::mapped)
+  {
+    mapped_file(path, begin, end).for_each_chunk(buffers.buffer_size(), buffers.size(), onChunk);
+    co_return;
+  }
+  if (mode == read_mode::automatic)
+  {
+    std::error_code ec;
+    const std::uint64_t fileSize = fs::file_size(path, ec);
+    if (!ec && std::min(end, fileSize) - std::min(begin, std::min(end, fileSize)) >= mmap_min_size)
+    {
+      std::optional<mapped_file> mapping;
+      try
+      {
+        mapping.emplace(path, begin, end);
+      }
+      catch (const std::system_error &)
+      {
+        // Leave it to read_chunks, which reports errors the usual way
+      }
+      if (mapping && mapping->resident_fraction() >= 0.9)
+      {
+        mapping->for_each_chunk(buffers.buffer_size(), buffers.size(), onChunk);
+        co_return;
+      }
+    }
+  }
+#endif
+  co_await read_chunks(ioService, std::move(path), buffers, std::move(onChunk), begin, end);
+}
+
+cppcoro::task<std::uint64_t> count_lines(cppcoro::io_service &ioService, fs::path path, BufferPool &buffers)
+{
+  std::uint64_t newlineCount = 0;
+  co_await scan_file(ioService, std::move(path), buffers, [&](const std::uint8_t *data, std::size_t size) {
+    newlineCount += ByteScan::count(data, size, '\n');
+  });
   co_return newlineCount;
 }
 
+// Runs process_events() of one io_service on several threads, so that
+// completions are handled by all of them rather than by a single thread.
+// By default there is one thread per CPU, each pinned to its CPU.
+// The threads return once the io_service is stopped, at the latest by the
+// destructor, which joins them.
+class io_event_threads
+{
+public:
+  explicit io_event_threads(cppcoro::io_service &ioService, const Topology::Placement &placement = Topology::Placement::compact())
+      : _ioService{ioService}
+  {
+    _threads.reserve(placement.size());
+    for (std::size_t i = 0; i < placement.size(); ++i)
+      _threads.emplace_back([&ioService, slot = placement[i]] {
+        slot.apply();
+        ioService.process_events();
+      });
+  }
+
+  explicit io_event_threads(cppcoro::io_service &ioService, std::size_t numThreads)
+      : io_event_threads(ioService, Topology::Placement::compact(numThreads))
+  {
+  }
+
+  io_event_threads(const io_event_threads &) = delete;
+
+  ~io_event_threads()
+  {
+    _ioService.stop();
+    for (auto &thread : _threads)
+      thread.join();
+  }
+
+  std::size_t size() const noexcept { return _threads.size(); }
+
+private:
+  cppcoro::io_service &_ioService;
+  std::vector<std::thread> _threads;
+};
+
+// One io_service per thread, by default one per CPU. Work started on a
+// shard, after co_await shard.schedule(), issues its reads from that
+// shard's thread and has their completions resumed there too. The shard
+// threads are pinned to the placement's CPUs, so that is the core which
+// issued the read, and the data read stays in its caches.
+class io_service_pool
+{
+public:
+  explicit io_service_pool(const Topology::Placement &placement = Topology::Placement::compact())
+  {
+    for (std::size_t i = 0; i < placement.size(); ++i)
+      _shards.push_back(std::make_unique<cppcoro::io_service>());
+    _threads.reserve(placement.size());
+    for (std::size_t i = 0; i < placement.size(); ++i)
+      _threads.emplace_back([ioService = _shards[i].get(), slot = placement[i]] {
+        slot.apply();
+        ioService->process_events();
+      });
+  }
+
+  explicit io_service_pool(std::size_t numShards) : io_service_pool(Topology::Placement::compact(numShards))
+  {
+  }
+
+  io_service_pool(const io_service_pool &) = delete;
+
+  ~io_service_pool()
+  {
+    for (auto &shard : _shards)
+      shard->stop();
+    for (auto &thread : _threads)
+      thread.join();
+  }
+
+  std::size_t size() const noexcept { return _shards.size(); }
+
+  cppcoro::io_service &get(std::size_t i) noexcept { return *_shards[i % _shards.size()]; }
+
+  // Shards in turn, to spread independent work
+  cppcoro::io_service &next() noexcept { return get(_next.fetch_add(1, std::memory_order_relaxed)); }
+
+private:
+  std::vector<std::unique_ptr<cppcoro::io_service>> _shards;
+  std::vector<std::thread> _threads;
+  std::atomic<std::size_t> _next{0};
+};
+
+// What count_lines_all reports for each file
+struct file_line_count
+{
+  fs::path path;
+  std::uint64_t lines = 0;
+  std::exception_ptr error; // Set if the file could not be read; lines is then partial
+};
+
+namespace detail
+{
+  struct line_count_state
+  {
+    struct file
+    {
+      std::atomic<std::uint64_t> lines{0};
+      std::atomic<std::size_t> rangesLeft{0};
+      std::exception_ptr error;
+    };
+
+    struct range
+    {
+      std::size_t file;
+      std::uint64_t begin, end;
+    };
+
+    // Pools are only made when a read needs one and none is free, so
+    // there are never more than reads in flight
+    BufferPool &take_pool()
+    {
+      std::lock_guard lock{mutex};
+      if (freePools.empty())
+      {
+        pools.push_back(std::make_unique<BufferPool>());
+        return *pools.back();
+      }
+      BufferPool &pool = *freePools.back();
+      freePools.pop_back();
+      return pool;
+    }
+
+    void return_pool(BufferPool &pool)
+    {
+      std::lock_guard lock{mutex};
+      freePools.push_back(&pool);
+    }
+
+    std::mutex mutex;
+    std::mutex callbackMutex; // One onFile call at a time
+    std::vector<std::unique_ptr<BufferPool>> pools;
+    std::vector<BufferPool *> freePools;
+    std::vector<file> files;
+    std::vector<range> ranges;
+    std::atomic<std::size_t> nextRange{0};
+  };
+
+  // One of maxInFlight readers: counts the lines of the next range not
+  // taken yet, on the io_service pickService(range index), until there
+  // are none left
+  template <class PickService, class OnFile>
+  cppcoro::task<> count_lines_worker(PickService &pickService, const std::vector<fs::path> &paths,
+                                     line_count_state &state, OnFile &onFile)
+  {
+    for (std::size_t i; (i = state.nextRange.fetch_add(1, std::memory_order_relaxed)) < state.ranges.size();)
+    {
+      const auto &range = state.ranges[i];
+      cppcoro::io_service &ioService = pickService(i);
+      // Issue the reads from that service's event thread, which also keeps
+      // the loop from nesting inside read completions
+      co_await ioService.schedule();
+      auto &file = state.files[range.file];
+      BufferPool &buffers = state.take_pool();
+      std::exception_ptr error;
+      try
+      {
+        // A newline belongs to exactly one range, so the counts simply add
+        // up and a split needs no fix-up at the range boundaries
+        std::uint64_t lines = 0;
+        co_await scan_file(ioService, paths[range.file], buffers, [&](const std::uint8_t *data, std::size_t size) {
+          lines += ByteScan::count(data, size, '\n');
+        }, range.begin, range.end);
+        file.lines.fetch_add(lines, std::memory_order_relaxed);
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      state.return_pool(buffers);
+
+      if (error)
+      {
+        std::lock_guard lock{state.mutex};
+        if (!file.error)
+          file.error = error;
+      }
+      // The last range of the file sees what the others stored before them
+      if (file.rangesLeft.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      {
+        std::lock_guard lock{state.callbackMutex};
+        onFile(file_line_count{paths[range.file], file.lines.load(std::memory_order_relaxed), file.error});
+      }
+    }
+  }
+
+  // The io_service of each range is pickService(range index)
+  template <class PickService, class OnFile>
+  cppcoro::task<std::uint64_t> count_lines_all_on(PickService pickService, std::vector<fs::path> paths,
+                                                  std::size_t maxInFlight, OnFile onFile, std::uint64_t splitSize)
+  {
+    line_count_state state;
+    state.files = std::vector<line_count_state::file>(paths.size());
+    splitSize = std::max<std::uint64_t>(splitSize, 1);
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+      std::error_code ec;
+      const std::uint64_t size = fs::file_size(paths[i], ec);
+      // A file we cannot stat gets one range, and fails where it is opened
+      const std::uint64_t numRanges = ec || size == 0 ? 1 : (size + splitSize - 1) / splitSize;
+      state.files[i].rangesLeft.store(numRanges, std::memory_order_relaxed);
+      for (std::uint64_t r = 0; r < numRanges; ++r)
+        state.ranges.push_back({i, r * splitSize, numRanges == 1 ? std::numeric_limits<std::uint64_t>::max() : (r + 1) * splitSize});
+    }
+
+    // As many coroutine frames as reads in flight, however many files
+    std::vector<cppcoro::task<>> workers;
+    const std::size_t numWorkers = std::min(std::max<std::size_t>(maxInFlight, 1), state.ranges.size());
+    for (std::size_t i = 0; i < numWorkers; ++i)
+      workers.push_back(count_lines_worker(pickService, paths, state, onFile));
+    co_await cppcoro::when_all_ready(std::move(workers));
+
+    std::uint64_t total = 0;
+    for (const auto &file : state.files)
+      total += file.lines.load(std::memory_order_relaxed);
+    co_return total;
+  }
+}
+
+// Counts the lines of every file, reading at most maxInFlight files or byte
+// ranges at a time, and calls onFile(const file_line_count &) for each file
+// as soon as it is done, one call at a time. Files bigger than splitSize are
+// cut into ranges of that size which are read in parallel. Returns the total.
+template <class OnFile>
+cppcoro::task<std::uint64_t> count_lines_all(cppcoro::io_service &ioService, std::vector<fs::path> paths,
+                                             std::size_t maxInFlight, OnFile onFile,
+                                             std::uint64_t splitSize = std::uint64_t(256) << 20)
+{
+  return detail::count_lines_all_on([&ioService](std::size_t) -> cppcoro::io_service & { return ioService; },
+                                    std::move(paths), maxInFlight, std::move(onFile), splitSize);
+}
+
+// Same, with the ranges dealt out over the shards of the pool: each range
+// is read, and counted, on its shard's thread
+template <class OnFile>
+cppcoro::task<std::uint64_t> count_lines_all(io_service_pool &ioServices, std::vector<fs::path> paths,
+                                             std::size_t maxInFlight, OnFile onFile,
+                                             std::uint64_t splitSize = std::uint64_t(256) << 20)
+{
+  return detail::count_lines_all_on([&ioServices](std::size_t i) -> cppcoro::io_service & { return ioServices.get(i); },
+                                    std::move(paths), maxInFlight, std::move(onFile), splitSize);
+}
+
+cppcoro::task<std::uint64_t> count_lines_all(cppcoro::io_service &ioService, std::vector<fs::path> paths, std::size_t maxInFlight)
+{
+  co_return co_await count_lines_all(ioService, std::move(paths), maxInFlight, [](const file_line_count &) {});
+}
+
 cppcoro::task<> run(cppcoro::io_service &ioService)
 {
   cppcoro::io_work_scope ioScope(ioService);
-  auto lineCount = co_await count_lines(ioService, fs::path{"foo.txt"});
+  BufferPool buffers;
+  auto lineCount = co_await count_lines(ioService, fs::path{"foo.txt"}, buffers);
   std::cout << "foo.txt has " << lineCount << " lines." << std::endl;
 }
 
@@ -40,6 +591,7 @@ cppcoro::task<> process_events(cppcoro::io_service &ioService)
   co_return;
 }
 
+#if 0 // P0443-style sketches: executor, require and prefer do not exist here
 template<executor E, class F, class... Args>
 auto really_async(const E& ex, F&& f, cppcoro::io_service &ioService, Args&&... args) {
   using namespace execution;
@@ -77,4 +629,5 @@ void do_async_work(
           execution::outstanding_work.tracked),
         callback);
   }
-}
\ No newline at end of file
+}
+#endif
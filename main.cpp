@@ -14,9 +14,9 @@ using namespace std::chrono;
 int main()
 {
   cppcoro::io_service ioService;
-  cppcoro::sync_wait(cppcoro::when_all_ready(
-    run(ioService),
-    process_events(ioService)));
+  // Completions are handled on one event thread per core
+  io_event_threads eventThreads{ioService};
+  cppcoro::sync_wait(run(ioService));
 
   return 0;
 }
\ No newline at end of file
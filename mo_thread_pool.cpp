@@ -1,17 +1,28 @@
+#include <algorithm>
 #include <atomic>
 #include <condition_variable>
 #include <coroutine>
+#include <cstdint>
+#include <exception>
 #include <functional>
 #include <iostream>
+#include <latch>
+#include <limits>
+#include <memory>
+#include <new>
 #include <optional>
 #include <queue>
 #include <shared_mutex>
 #include <string_view>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <vector>
 #include <chrono>
 
+#include "SchedStats.h"
+#include "Topology.h"
+
 
 template <typename... Ts>
 void display(Ts... ts)
@@ -101,6 +112,22 @@ public:
         m_queue.wait(hasElement, st);
     }
 
+    // Moves up to maxCount elements, oldest first, to the end of batch in
+    // one lock round trip; returns how many. The caller keeps the batch
+    // between calls, so that its storage is reused.
+    std::size_t drainAll(std::vector<T> &batch, std::size_t maxCount = std::numeric_limits<std::size_t>::max())
+    {
+        return m_queue.with_lock([&](auto &queue) {
+            std::size_t count = 0;
+            for (; count < maxCount && !queue.empty(); ++count)
+            {
+                batch.push_back(std::move(queue.front()));
+                queue.pop();
+            }
+            return count;
+        });
+    }
+
 private:
     ConditionVariable<std::queue<T>> m_queue;
 };
@@ -120,7 +147,7 @@ public:
     Awaiter(std::coroutine_handle<Args...> handle) : m_handle{handle} {}
 
     Awaiter(const Awaiter &) = delete;
-    Awaiter(Awaiter &&a) : m_handle{a.m_handle} { a.m_handle = nullptr; }
+    Awaiter(Awaiter &&a) : m_queued{a.m_queued}, m_handle{a.m_handle} { a.m_handle = nullptr; }
 
     void resume()
     {
@@ -128,65 +155,839 @@ public:
         m_handle = nullptr;
     }
 
+    [[no_unique_address]] SchedStats::Stamp m_queued; // Set by the scheduler
+
 private:
     std::coroutine_handle<> m_handle = nullptr;
 };
 
+// Queue link of a suspended coroutine. It is embedded in the awaitable,
+// which lives in the coroutine frame for as long as the coroutine waits,
+// so queueing a coroutine does not allocate.
+struct AwaiterNode
+{
+    using Clock = std::chrono::steady_clock;
+
+    std::atomic<AwaiterNode *> m_next{nullptr};
+    std::coroutine_handle<> m_handle = nullptr;
+    Clock::time_point m_deadline{}; // Not before then; the default means now
+    std::size_t m_wheelSlot = 0;     // Where the TimerWheel last placed it
+    [[no_unique_address]] SchedStats::Stamp m_queued;
+};
+
+// Intrusive lock-free multi-producer single-consumer queue of AwaiterNodes
+// (Vyukov's algorithm), the single-consumer alternative to ThreadSafeQueue.
+// A producer enqueues with one exchange and only takes the lock to wake the
+// consumer when it has announced that it is going to sleep.
+class MpscAwaiterQueue
+{
+public:
+    MpscAwaiterQueue() : m_head{&m_stub}, m_tail{&m_stub} {}
+
+    MpscAwaiterQueue(const MpscAwaiterQueue &) = delete;
+
+    // The node may be dequeued, and its frame resumed, before push returns:
+    // the caller must not touch it afterwards. Returns whether the consumer
+    // had to be woken up.
+    bool push(AwaiterNode &node)
+    {
+        link(node);
+        if (m_sleeping.load() && m_sleeping.exchange(false))
+        {
+            std::lock_guard lock{m_mutex};
+            m_cond.notify_one();
+            return true;
+        }
+        return false;
+    }
+
+    // Consumer only. Returns nullptr when empty, or when the next producer
+    // has not finished linking its node yet.
+    AwaiterNode *pop()
+    {
+        AwaiterNode *tail = m_tail;
+        AwaiterNode *next = tail->m_next.load(std::memory_order_acquire);
+        if (tail == &m_stub)
+        {
+            if (!next)
+                return nullptr;
+            m_tail = tail = next;
+            next = next->m_next.load(std::memory_order_acquire);
+        }
+        if (next)
+        {
+            m_tail = next;
+            return tail;
+        }
+        if (tail != m_head.load(std::memory_order_acquire))
+            return nullptr;
+        // tail is the last node: put the stub behind it so it can be unlinked
+        link(m_stub);
+        if ((next = tail->m_next.load(std::memory_order_acquire)))
+        {
+            m_tail = next;
+            return tail;
+        }
+        return nullptr;
+    }
+
+    // Consumer only. Dequeues and passes to f up to maxCount nodes in FIFO
+    // order, stopping early at a producer which is still linking its node.
+    // Nodes pushed meanwhile, say by the coroutines f resumes, may become
+    // part of the batch; the cap bounds how long the consumer stays here.
+    template <typename F>
+    std::size_t drainAll(F &&f, std::size_t maxCount = std::numeric_limits<std::size_t>::max())
+    {
+        std::size_t count = 0;
+        for (; count < maxCount; ++count)
+        {
+            AwaiterNode *node = pop();
+            if (!node)
+                break;
+            std::invoke(f, *node);
+        }
+        return count;
+    }
+
+    // Consumer only
+    bool empty() const
+    {
+        return m_head.load() == m_tail && !m_tail->m_next.load(std::memory_order_acquire);
+    }
+
+    // Consumer only. Parks until something is pushed, stop is requested or
+    // the deadline, if any, has passed.
+    void waitForAnElement(std::stop_token st, std::optional<AwaiterNode::Clock::time_point> deadline = std::nullopt)
+    {
+        std::unique_lock lock{m_mutex};
+        m_sleeping.store(true);
+        auto woken = [this] { return !m_sleeping.load() || !empty(); };
+        if (deadline)
+            m_cond.wait_until(lock, st, *deadline, woken);
+        else
+            m_cond.wait(lock, st, woken);
+        m_sleeping.store(false);
+    }
+
+private:
+    void link(AwaiterNode &node)
+    {
+        node.m_next.store(nullptr, std::memory_order_relaxed);
+        AwaiterNode *prev = m_head.exchange(&node);
+        prev->m_next.store(&node, std::memory_order_release);
+    }
+
+    std::atomic<AwaiterNode *> m_head; // Producers
+    alignas(64) AwaiterNode *m_tail;   // Consumer
+    AwaiterNode m_stub;
+    alignas(64) std::atomic<bool> m_sleeping{false};
+    std::mutex m_mutex;
+    std::condition_variable_any m_cond;
+};
+
+// Hierarchical timer wheel of AwaiterNodes with a 1ms tick: 4 levels of
+// 64 slots, covering about 4.6 hours; later deadlines wait in the last level
+// and are placed again when it comes round. Nodes are linked through their
+// m_next, and only the owning thread touches the wheel.
+class TimerWheel
+{
+public:
+    using Clock = AwaiterNode::Clock;
+
+    explicit TimerWheel(Clock::time_point now = Clock::now()) : m_start{now} {}
+
+    bool empty() const { return m_size == 0; }
+
+    // Returns false, and keeps nothing, when the node is already due
+    bool insert(AwaiterNode &node, Clock::time_point now)
+    {
+        if (empty())
+            m_now = std::max(m_now, floorTick(now));
+        if (node.m_deadline <= now || ceilTick(node.m_deadline) <= m_now)
+            return false;
+        place(node);
+        ++m_size;
+        return true;
+    }
+
+    // Passes every node due by now to f, in deadline order within a tick.
+    // Returns how many there were.
+    template <typename F>
+    std::size_t advance(Clock::time_point now, F &&f)
+    {
+        std::size_t count = 0;
+        for (const std::uint64_t target = floorTick(now); m_now < target;)
+        {
+            if (empty())
+            {
+                m_now = target;
+                break;
+            }
+            ++m_now;
+            for (std::size_t level = Levels - 1; level > 0; --level)
+                if ((m_now & ((std::uint64_t(1) << (SlotBits * level)) - 1)) == 0)
+                    for (AwaiterNode *node = takeSlot(level, slotOf(m_now, level)); node;)
+                    {
+                        AwaiterNode *next = node->m_next.load(std::memory_order_relaxed);
+                        if (ceilTick(node->m_deadline) <= m_now)
+                            fire(*node, f, count);
+                        else
+                            place(*node);
+                        node = next;
+                    }
+            for (AwaiterNode *node = takeSlot(0, slotOf(m_now, 0)); node;)
+            {
+                AwaiterNode *next = node->m_next.load(std::memory_order_relaxed);
+                fire(*node, f, count);
+                node = next;
+            }
+        }
+        return count;
+    }
+
+    // When advance should next be called, at the latest
+    std::optional<Clock::time_point> nextDeadline() const
+    {
+        if (empty())
+            return std::nullopt;
+        std::uint64_t best = std::numeric_limits<std::uint64_t>::max();
+        for (std::size_t level = 0; level < Levels; ++level)
+            for (std::uint64_t i = 1; i <= Slots; ++i)
+            {
+                const std::uint64_t block = (m_now >> (SlotBits * level)) + i;
+                if (m_slots[level][block & (Slots - 1)])
+                {
+                    best = std::min(best, block << (SlotBits * level));
+                    break;
+                }
+            }
+        return m_start + Resolution * best;
+    }
+
+    // Takes the node out of the wheel before its deadline. Returns false if
+    // it is not waiting there, e.g. because it has already fired. Not to be
+    // called from within advance's f.
+    bool erase(AwaiterNode &node)
+    {
+        AwaiterNode *&head = m_slots[node.m_wheelSlot / Slots][node.m_wheelSlot % Slots];
+        AwaiterNode *prev = nullptr;
+        for (AwaiterNode *n = head; n; prev = std::exchange(n, n->m_next.load(std::memory_order_relaxed)))
+            if (n == &node)
+            {
+                AwaiterNode *next = n->m_next.load(std::memory_order_relaxed);
+                if (prev)
+                    prev->m_next.store(next, std::memory_order_relaxed);
+                else
+                    head = next;
+                --m_size;
+                return true;
+            }
+        return false;
+    }
+
+    // Passes every node still waiting to f, then forgets them
+    template <typename F>
+    void clear(F &&f)
+    {
+        for (auto &level : m_slots)
+            for (auto &slot : level)
+                for (AwaiterNode *node = std::exchange(slot, nullptr); node;)
+                    std::invoke(f, *std::exchange(node, node->m_next.load(std::memory_order_relaxed)));
+        m_size = 0;
+    }
+
+private:
+    static constexpr std::chrono::milliseconds Resolution{1};
+    static constexpr std::size_t Levels = 4;
+    static constexpr std::size_t SlotBits = 6;
+    static constexpr std::size_t Slots = 1 << SlotBits;
+
+    std::uint64_t floorTick(Clock::time_point tp) const
+    {
+        return tp <= m_start ? 0 : std::uint64_t((tp - m_start) / Resolution);
+    }
+
+    std::uint64_t ceilTick(Clock::time_point tp) const
+    {
+        const std::uint64_t tick = floorTick(tp);
+        return m_start + Resolution * tick < tp ? tick + 1 : tick;
+    }
+
+    static std::size_t slotOf(std::uint64_t tick, std::size_t level)
+    {
+        return std::size_t(tick >> (SlotBits * level)) & (Slots - 1);
+    }
+
+    void place(AwaiterNode &node)
+    {
+        std::uint64_t tick = ceilTick(node.m_deadline);
+        const std::uint64_t horizon = std::uint64_t(1) << (SlotBits * Levels);
+        tick = std::min(tick, m_now + horizon - 1); // Placed again on the way
+        std::size_t level = 0;
+        while (level + 1 < Levels && tick - m_now >= (std::uint64_t(1) << (SlotBits * (level + 1))))
+            ++level;
+        node.m_wheelSlot = level * Slots + slotOf(tick, level);
+        AwaiterNode *&slot = m_slots[level][slotOf(tick, level)];
+        node.m_next.store(slot, std::memory_order_relaxed);
+        slot = &node;
+    }
+
+    AwaiterNode *takeSlot(std::size_t level, std::size_t slot)
+    {
+        // Slots are pushed at the front: reverse them back into insertion order
+        AwaiterNode *reversed = nullptr;
+        for (AwaiterNode *node = std::exchange(m_slots[level][slot], nullptr); node;)
+        {
+            AwaiterNode *next = node->m_next.load(std::memory_order_relaxed);
+            node->m_next.store(reversed, std::memory_order_relaxed);
+            reversed = std::exchange(node, next);
+        }
+        return reversed;
+    }
+
+    template <typename F>
+    void fire(AwaiterNode &node, F &f, std::size_t &count)
+    {
+        --m_size;
+        ++count;
+        std::invoke(f, node);
+    }
+
+    Clock::time_point m_start;
+    std::uint64_t m_now = 0; // Ticks since m_start, all of them processed
+    std::size_t m_size = 0;
+    AwaiterNode *m_slots[Levels][Slots] = {};
+};
+
 class Thread
 {
-    struct Awaitable
+    using Clock = AwaiterNode::Clock;
+
+    struct Awaitable : AwaiterNode
     {
+        explicit Awaitable(Thread &thread, Clock::time_point deadline = {}) : thread{thread}
+        {
+            m_deadline = deadline;
+        }
+
         Thread &thread;
         bool await_ready() { return false; }
 
         void await_suspend(std::coroutine_handle<> handle)
         {
-            thread.addAwaiter({handle});
+            m_handle = handle;
+            thread.schedule(*this);
         }
 
         void await_resume() {}
     };
 
 public:
-    Thread()
+    // maxBatch caps how many coroutines run between two checks for stop
+    explicit Thread(std::size_t maxBatch = 64) : Thread(Topology::Slot{}, maxBatch) {}
+
+    // Runs pinned to the slot's CPU, if it has one; e.g. one Thread per slot
+    // of a Topology::Placement. The frames the thread caches are then local
+    // to its node as well.
+    explicit Thread(Topology::Slot slot, std::size_t maxBatch = 64) : m_maxBatch{std::max<std::size_t>(maxBatch, 1)}, m_stats{1}
     {
-        m_thread = std::jthread([this](std::stop_token st) { run(st); });
+        m_thread = std::jthread([this, slot](std::stop_token st) {
+            slot.apply();
+            run(st);
+        });
     }
 
-    void addAwaiter(Awaiter &&awaiter) { m_awaiters.push(std::move(awaiter)); }
+    ~Thread()
+    {
+        m_thread.request_stop();
+        m_thread.join();
+        // Coroutines still waiting for this thread will never run
+        while (!m_awaiters.empty())
+            if (auto node = m_awaiters.pop())
+                node->m_handle.destroy();
+        m_timers.clear([](AwaiterNode &node) { node.m_handle.destroy(); });
+    }
 
     auto id() { return m_thread.get_id(); }
 
-    Awaitable operator co_await() { return {*this}; }
+    Awaitable operator co_await() { return Awaitable{*this}; }
+
+    // Resumes the coroutine on this thread once the time has come
+    Awaitable sleep_until(Clock::time_point deadline) { return Awaitable{*this, std::max(deadline, Clock::time_point{} + Clock::duration{1})}; }
+
+    template <typename Rep, typename Period>
+    Awaitable sleep_for(std::chrono::duration<Rep, Period> duration)
+    {
+        return sleep_until(Clock::now() + std::chrono::ceil<Clock::duration>(duration));
+    }
+
+    // Queues the node's coroutine, to be resumed on this thread at the
+    // node's deadline. The node must stay alive until then.
+    void schedule(AwaiterNode &node)
+    {
+        node.m_queued = m_stats.enqueued();
+        if (m_awaiters.push(node))
+            m_stats.wokeUp();
+    }
+
+    // Ends the sleep of a node waiting for its deadline and resumes its
+    // coroutine now. Only on this thread, and not from a coroutine the timers
+    // resumed; to get here from elsewhere, co_await the thread first.
+    // Returns false if the node is not waiting for its deadline (anymore).
+    bool wake(AwaiterNode &node)
+    {
+        if (!m_timers.erase(node))
+            return false;
+        // Runs inside the resume of the caller, which counts the busy time
+        m_stats.worker(0).started(node.m_queued);
+        node.m_handle.resume();
+        return true;
+    }
+
+    // The Thread running the calling coroutine, if any
+    static Thread *current() { return t_current; }
+
+    // Counters of this thread, see SchedStats.h. A sleeper's wait is counted
+    // from its deadline on. Empty unless built with SCHED_STATS.
+    SchedStats::Snapshot stats() const { return m_stats.snapshot(); }
 
 private:
     void run(std::stop_token st)
     {
+        t_current = this;
+        auto &stats = m_stats.worker(0);
+        auto resume = [&stats](AwaiterNode &node, SchedStats::Stamp queued) {
+            auto start = stats.started(queued);
+            node.m_handle.resume();
+            stats.finished(start);
+        };
+        auto dispatch = [&](AwaiterNode &node) {
+            if (node.m_deadline == Clock::time_point{} || !m_timers.insert(node, Clock::now()))
+                resume(node, node.m_queued);
+        };
         while (!st.stop_requested())
         {
-            m_awaiters.waitForAnElement(st);
-
-            auto awaiter = m_awaiters.pop();
-
-            if (awaiter)
-                awaiter->resume();
+            std::size_t count = m_awaiters.drainAll(dispatch, m_maxBatch);
+            if (!m_timers.empty())
+                count += m_timers.advance(Clock::now(), [&](AwaiterNode &node) { resume(node, SchedStats::stampAt(node.m_deadline)); });
+            if (count)
+                continue;
+            // Sleep until the next deadline, not a tick longer
+            if (m_awaiters.empty())
+            {
+                auto parked = stats.parking();
+                m_awaiters.waitForAnElement(st, m_timers.nextDeadline());
+                stats.unparked(parked);
+            }
+            else
+                std::this_thread::yield(); // A producer is half way through push
         }
     }
 
+    static inline thread_local Thread *t_current = nullptr;
+
   private:
-    ThreadSafeQueue<Awaiter> m_awaiters;
+    MpscAwaiterQueue m_awaiters;
+    TimerWheel m_timers;
+    std::size_t m_maxBatch;
+    [[no_unique_address]] SchedStats::Stats m_stats;
     std::jthread m_thread;
 };
 
+// Suspends the calling coroutine until the deadline, and resumes it on the
+// same Thread. Outside of a Thread the calling thread simply sleeps.
+inline auto sleep_until(AwaiterNode::Clock::time_point deadline)
+{
+    struct Awaitable : AwaiterNode
+    {
+        explicit Awaitable(Clock::time_point deadline) { m_deadline = std::max(deadline, Clock::time_point{} + Clock::duration{1}); }
+
+        Thread *thread = Thread::current();
+
+        bool await_ready()
+        {
+            if (thread)
+                return false;
+            std::this_thread::sleep_until(m_deadline);
+            return true;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            m_handle = handle;
+            thread->schedule(*this);
+        }
+
+        void await_resume() {}
+    };
+    return Awaitable{deadline};
+}
+
+template <typename Rep, typename Period>
+auto sleep_for(std::chrono::duration<Rep, Period> duration)
+{
+    return sleep_until(AwaiterNode::Clock::now() + std::chrono::ceil<AwaiterNode::Clock::duration>(duration));
+}
+
+// Pool of worker threads resuming coroutines, the multi-threaded
+// counterpart of Thread. co_await pool.schedule() continues the coroutine
+// on whichever worker is less loaded (of two candidates, the current worker
+// first); idle workers steal from the others' queues before parking.
+// co_await pool.schedule_on(i) always continues on worker i, for work that
+// wants to stay next to its data.
+class CoroThreadPool
+{
+    struct Worker
+    {
+        ThreadSafeQueue<Awaiter> shared; // Stealable by idle workers
+        ThreadSafeQueue<Awaiter> pinned; // Only run by this worker
+        std::atomic<std::size_t> load{0};       // Both queues, for placement
+        std::atomic<std::size_t> pinnedLoad{0};
+    };
+
+    struct Awaitable
+    {
+        CoroThreadPool &pool;
+        std::size_t index;
+        bool pinned;
+
+        bool await_ready() { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            pool.enqueue({handle}, pinned ? index : pool.pickWorker(), pinned);
+        }
+
+        void await_resume() {}
+    };
+
+public:
+    explicit CoroThreadPool(std::size_t numThreads = Topology::cpuCount()) : CoroThreadPool(Topology::Placement(numThreads)) {}
+
+    // One worker per slot of the placement. Each worker is pinned before it
+    // allocates its queues, and steals on its own node before going further.
+    explicit CoroThreadPool(const Topology::Placement &placement)
+        : m_workers(placement.size()), m_started{std::ptrdiff_t(placement.size() + 1)}, m_stats{placement.size()}
+    {
+        for (std::size_t i = 0; i < placement.size(); ++i)
+            m_victims.push_back(placement.victims(i));
+        for (std::size_t i = 0; i < placement.size(); ++i)
+            m_threads.emplace_back([this, i, slot = placement[i]](std::stop_token st) {
+                slot.apply();
+                m_workers[i] = std::make_unique<Worker>();
+                m_started.arrive_and_wait();
+                run(i, st);
+            });
+        m_started.arrive_and_wait();
+    }
+
+    ~CoroThreadPool()
+    {
+        for (auto &thread : m_threads)
+            thread.request_stop();
+        m_signal.fetch_add(1);
+        m_signal.notify_all();
+        // Join everyone before any queue goes away, a thief may still be in it
+        for (auto &thread : m_threads)
+            thread.join();
+    }
+
+    CoroThreadPool(const CoroThreadPool &) = delete;
+
+    std::size_t size() const { return m_workers.size(); }
+
+    Awaitable schedule() { return {*this, 0, false}; }
+
+    Awaitable schedule_on(std::size_t index) { return {*this, index % m_workers.size(), true}; }
+
+    // Counters of the workers, see SchedStats.h. Empty unless built with
+    // SCHED_STATS.
+    SchedStats::Snapshot stats() const { return m_stats.snapshot(); }
+
+private:
+    std::size_t pickWorker()
+    {
+        const std::size_t n = m_workers.size();
+        std::size_t first = t_pool == this ? t_index : m_next.fetch_add(1, std::memory_order_relaxed) % n;
+        std::size_t second = (first + 1 + m_next.fetch_add(1, std::memory_order_relaxed) % (n - 1 ? n - 1 : 1)) % n;
+        return m_workers[second]->load.load(std::memory_order_relaxed) < m_workers[first]->load.load(std::memory_order_relaxed) ? second : first;
+    }
+
+    void enqueue(Awaiter &&awaiter, std::size_t index, bool pinned)
+    {
+        Worker &worker = *m_workers[index];
+        awaiter.m_queued = m_stats.enqueued();
+        worker.load.fetch_add(1, std::memory_order_relaxed);
+        // Counted before the push, so that a consumer never sees more
+        // awaiters than counted
+        if (pinned)
+        {
+            worker.pinnedLoad.fetch_add(1);
+            worker.pinned.push(std::move(awaiter));
+        }
+        else
+        {
+            m_pending.fetch_add(1);
+            worker.shared.push(std::move(awaiter));
+        }
+        if (m_sleepers.load() > 0)
+        {
+            m_signal.fetch_add(1);
+            // A pinned awaiter needs its own worker, which notify_one may miss
+            if (pinned)
+                m_signal.notify_all();
+            else
+                m_signal.notify_one();
+            m_stats.wokeUp();
+        }
+    }
+
+    std::optional<Awaiter> take(std::size_t index)
+    {
+        Worker &own = *m_workers[index];
+        if (auto awaiter = own.shared.pop())
+        {
+            own.load.fetch_sub(1, std::memory_order_relaxed);
+            m_pending.fetch_sub(1);
+            return awaiter;
+        }
+        for (std::size_t k : m_victims[index])
+        {
+            Worker &victim = *m_workers[k];
+            if (victim.load.load(std::memory_order_relaxed) == 0)
+                continue;
+            if (auto awaiter = victim.shared.pop())
+            {
+                victim.load.fetch_sub(1, std::memory_order_relaxed);
+                m_pending.fetch_sub(1);
+                m_stats.worker(index).stole();
+                return awaiter;
+            }
+        }
+        return std::nullopt;
+    }
+
+    void run(std::size_t index, std::stop_token st)
+    {
+        t_pool = this;
+        t_index = index;
+        Worker &own = *m_workers[index];
+        auto &stats = m_stats.worker(index);
+        auto resume = [&stats](Awaiter &awaiter) {
+            auto start = stats.started(awaiter.m_queued);
+            awaiter.resume();
+            stats.finished(start);
+        };
+        std::vector<Awaiter> batch;
+        batch.reserve(MaxPinnedBatch);
+        while (!st.stop_requested())
+        {
+            // Pinned awaiters can only run here, so they are taken in batches
+            if (own.pinnedLoad.load(std::memory_order_relaxed) > 0)
+            {
+                const std::size_t count = own.pinned.drainAll(batch, MaxPinnedBatch);
+                own.load.fetch_sub(count, std::memory_order_relaxed);
+                own.pinnedLoad.fetch_sub(count);
+                for (Awaiter &awaiter : batch)
+                    resume(awaiter);
+                batch.clear();
+                continue;
+            }
+            if (auto awaiter = take(index))
+            {
+                resume(*awaiter);
+                continue;
+            }
+            // Go to sleep, unless something we may run was queued since the scan
+            auto signal = m_signal.load();
+            m_sleepers.fetch_add(1);
+            if (m_pending.load() == 0 && own.pinnedLoad.load() == 0 && !st.stop_requested())
+            {
+                auto parked = stats.parking();
+                m_signal.wait(signal);
+                stats.unparked(parked);
+            }
+            m_sleepers.fetch_sub(1);
+        }
+    }
+
+    static constexpr std::size_t MaxPinnedBatch = 64;
+
+    static inline thread_local CoroThreadPool *t_pool = nullptr;
+    static inline thread_local std::size_t t_index = 0;
+
+    std::vector<std::unique_ptr<Worker>> m_workers;  // Allocated by their threads
+    std::vector<std::vector<std::size_t>> m_victims; // Steal order of each worker
+    std::latch m_started;                            // Every worker is there
+    std::vector<std::jthread> m_threads;
+    std::atomic<std::size_t> m_pending{0}; // Stealable awaiters over all workers
+    std::atomic<std::size_t> m_sleepers{0};
+    std::atomic<std::size_t> m_next{0};
+    std::atomic<std::uint32_t> m_signal{0};
+    [[no_unique_address]] SchedStats::Stats m_stats;
+};
+
+// Per-thread cache of coroutine frames, in size classes of 64 bytes up to
+// 4 KiB. A frame is returned to the cache of the thread where it is freed,
+// which need not be the one which allocated it; each class keeps at most
+// MaxCached frames and hands the rest back to the global heap. Bigger frames
+// always go to the heap.
+class FrameArena
+{
+public:
+    struct Stats
+    {
+        std::size_t hits = 0;        // Allocations served from the cache
+        std::size_t misses = 0;      // Allocations which went to the heap
+        std::size_t cachedBytes = 0;     // Held by the cache right now
+        std::size_t peakCachedBytes = 0; // Highest cachedBytes so far
+        // Frames handed out and not freed yet, over all threads, since a
+        // frame is often freed by another thread than the one allocating it.
+        // Only counted when built with SCHED_STATS, as its atomics are
+        // shared by every thread.
+        std::size_t liveBytes = 0;
+        std::size_t peakBytes = 0; // Highest liveBytes so far
+
+        double hitRate() const { return hits + misses ? double(hits) / double(hits + misses) : 0.0; }
+    };
+
+    using Hook = void (*)(const Stats &);
+
+    static void *allocate(std::size_t size)
+    {
+        const std::size_t sizeClass = classOf(size);
+        if (sizeClass >= NumClasses)
+            return addLive(::operator new(size), size);
+        // Always the whole class, as another thread may cache the frame
+        const std::size_t bytes = bytesOf(sizeClass);
+        if (t_alive)
+        {
+            Cache &cache = local();
+            if (FreeNode *node = cache.heads[sizeClass])
+            {
+                cache.heads[sizeClass] = node->next;
+                --cache.counts[sizeClass];
+                cache.stats.cachedBytes -= bytes;
+                ++cache.stats.hits;
+                return addLive(node, bytes);
+            }
+            ++cache.stats.misses;
+        }
+        return addLive(::operator new(bytes), bytes);
+    }
+
+    static void deallocate(void *p, std::size_t size) noexcept
+    {
+        const std::size_t sizeClass = classOf(size);
+        subLive(sizeClass < NumClasses ? bytesOf(sizeClass) : size);
+        if (sizeClass < NumClasses && t_alive)
+        {
+            Cache &cache = local();
+            if (cache.counts[sizeClass] < MaxCached)
+            {
+                cache.heads[sizeClass] = ::new (p) FreeNode{cache.heads[sizeClass]};
+                ++cache.counts[sizeClass];
+                cache.stats.cachedBytes += bytesOf(sizeClass);
+                cache.stats.peakCachedBytes = std::max(cache.stats.peakCachedBytes, cache.stats.cachedBytes);
+                return;
+            }
+        }
+        ::operator delete(p);
+    }
+
+    // Statistics of the calling thread's cache, and the live frame bytes
+    static Stats stats() noexcept { return withLive(t_alive ? local().stats : Stats{}); }
+
+    // Called with a thread's final statistics when that thread exits
+    static void setExitHook(Hook hook) noexcept { s_exitHook.store(hook); }
+
+private:
+    static constexpr std::size_t Granularity = 64;
+    static constexpr std::size_t NumClasses = 64;
+    static constexpr std::size_t MaxCached = 256;
+
+    struct FreeNode
+    {
+        FreeNode *next;
+    };
+
+    struct Cache
+    {
+        FreeNode *heads[NumClasses] = {};
+        std::size_t counts[NumClasses] = {};
+        Stats stats;
+
+        ~Cache()
+        {
+            // Frames freed later in this thread's exit go straight to the heap
+            t_alive = false;
+            if (Hook hook = s_exitHook.load())
+                hook(withLive(stats));
+            for (FreeNode *head : heads)
+                while (head)
+                    ::operator delete(std::exchange(head, head->next));
+        }
+    };
+
+    static Stats withLive(Stats stats) noexcept
+    {
+        stats.liveBytes = s_liveBytes.load(std::memory_order_relaxed);
+        stats.peakBytes = s_peakBytes.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    // Counts the frame at p as live once it is there, so a bad_alloc
+    // leaves the count alone
+    static void *addLive(void *p, std::size_t bytes) noexcept
+    {
+        if constexpr (SchedStats::enabled)
+        {
+            const std::size_t live = s_liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+            std::size_t peak = s_peakBytes.load(std::memory_order_relaxed);
+            while (live > peak && !s_peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+                ;
+        }
+        return p;
+    }
+
+    static void subLive(std::size_t bytes) noexcept
+    {
+        if constexpr (SchedStats::enabled)
+            s_liveBytes.fetch_sub(bytes, std::memory_order_relaxed);
+    }
+
+    static std::size_t classOf(std::size_t size) { return (size + Granularity - 1) / Granularity - 1; }
+    static std::size_t bytesOf(std::size_t sizeClass) { return (sizeClass + 1) * Granularity; }
+
+    static Cache &local()
+    {
+        thread_local Cache cache;
+        return cache;
+    }
+
+    static inline thread_local bool t_alive = true;
+    static inline std::atomic<Hook> s_exitHook{nullptr};
+    alignas(64) static inline std::atomic<std::size_t> s_liveBytes{0};
+    static inline std::atomic<std::size_t> s_peakBytes{0};
+};
+
+// Base of the promise types, to allocate their frames from the FrameArena
+struct ArenaAllocated
+{
+    static void *operator new(std::size_t size) { return FrameArena::allocate(size); }
+    static void operator delete(void *p, std::size_t size) noexcept { FrameArena::deallocate(p, size); }
+};
+
 struct task
 {
-    struct promise_type
+    struct promise_type : ArenaAllocated
     {
         task get_return_object() { return {}; }
         std::suspend_never initial_suspend() noexcept { return {}; }
         std::suspend_never final_suspend() noexcept { return {}; }
         void return_void() {}
-        void unhandled_exception() noexcept {}
+        // Nobody is there to receive the exception of a fire-and-forget task.
+        void unhandled_exception() noexcept { std::terminate(); }
 
         ~promise_type() {}
     };
@@ -194,29 +995,402 @@ struct task
     ~task() {}
 };
 
-std::atomic_bool done = false;
+// One-shot completion flag which a thread can park on.
+// The setter first publishes Ready and wakes the waiter, and only then
+// stores Done as its very last access. wait() returns only after Done, so
+// the flag may be destroyed as soon as wait() returns.
+class CompletionFlag
+{
+public:
+    void set() noexcept
+    {
+        m_state.store(Ready, std::memory_order_release);
+        m_state.notify_one();
+        m_state.store(Done, std::memory_order_release);
+    }
+
+    void wait() noexcept
+    {
+        for (int s = m_state.load(std::memory_order_acquire); s != Done; s = m_state.load(std::memory_order_acquire))
+        {
+            if (s == Empty)
+                m_state.wait(Empty, std::memory_order_acquire);
+            else
+                std::this_thread::yield(); // Ready: the setter is on its last instruction
+        }
+    }
+
+private:
+    enum : int { Empty, Ready, Done };
+    std::atomic<int> m_state{Empty};
+};
+
+template <typename T>
+class Task;
+
+namespace detail
+{
+    // Resumes whoever awaited the task, through symmetric transfer, so that a
+    // chain of tasks completing one another runs in constant stack depth.
+    struct FinalAwaiter
+    {
+        bool await_ready() noexcept { return false; }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept
+        {
+            if (auto continuation = handle.promise().m_continuation)
+                return continuation;
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    struct TaskPromiseBase : ArenaAllocated
+    {
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        FinalAwaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() noexcept { m_exception = std::current_exception(); }
+
+        void rethrowIfFailed()
+        {
+            if (m_exception)
+                std::rethrow_exception(m_exception);
+        }
+
+        std::coroutine_handle<> m_continuation = nullptr;
+        std::exception_ptr m_exception;
+    };
+
+    template <typename T>
+    struct TaskPromise : TaskPromiseBase
+    {
+        Task<T> get_return_object() noexcept;
+
+        template <typename U>
+        void return_value(U &&value) { m_value.emplace(FWD(value)); }
+
+        T result()
+        {
+            rethrowIfFailed();
+            return std::move(*m_value);
+        }
+
+        std::optional<T> m_value;
+    };
+
+    template <>
+    struct TaskPromise<void> : TaskPromiseBase
+    {
+        Task<void> get_return_object() noexcept;
+
+        void return_void() noexcept {}
+
+        void result() { rethrowIfFailed(); }
+    };
+}
+
+// Lazily started coroutine producing a T (or an exception).
+// The body does not run until the task is co_awaited (or passed to
+// sync_wait); on completion it resumes the awaiting coroutine directly.
+// Combined with co_await on a Thread, a coroutine can hop between threads:
+//
+//     Task<int> work(Thread &t) { co_await t; co_return 42; }
+//     int x = sync_wait(work(thread));
+template <typename T = void>
+class Task
+{
+public:
+    using promise_type = detail::TaskPromise<T>;
+
+    Task(Task &&other) noexcept : m_handle{std::exchange(other.m_handle, nullptr)} {}
+    Task(const Task &) = delete;
+
+    ~Task()
+    {
+        if (m_handle)
+            m_handle.destroy();
+    }
+
+    auto operator co_await() && noexcept
+    {
+        struct Awaitable
+        {
+            std::coroutine_handle<promise_type> handle;
+
+            bool await_ready() noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+            {
+                handle.promise().m_continuation = awaiting;
+                return handle; // Start the task in place of the awaiting coroutine
+            }
+
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaitable{m_handle};
+    }
+
+private:
+    friend promise_type;
+    explicit Task(std::coroutine_handle<promise_type> handle) noexcept : m_handle{handle} {}
+
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail
+{
+    template <typename T>
+    Task<T> TaskPromise<T>::get_return_object() noexcept
+    {
+        return Task<T>{std::coroutine_handle<TaskPromise<T>>::from_promise(*this)};
+    }
 
-task f(Thread &thread1, Thread &thread2)
+    inline Task<void> TaskPromise<void>::get_return_object() noexcept
+    {
+        return Task<void>{std::coroutine_handle<TaskPromise<void>>::from_promise(*this)};
+    }
+
+    // The coroutine sync_wait uses to await the task. sync_wait starts it and
+    // it sets the flag at its final suspend point.
+    struct SyncWaitTask
+    {
+        struct promise_type : ArenaAllocated
+        {
+            CompletionFlag *m_flag = nullptr;
+
+            SyncWaitTask get_return_object() noexcept
+            {
+                return SyncWaitTask{std::coroutine_handle<promise_type>::from_promise(*this)};
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            auto final_suspend() noexcept
+            {
+                struct Notifier
+                {
+                    bool await_ready() noexcept { return false; }
+                    void await_suspend(std::coroutine_handle<promise_type> handle) noexcept
+                    {
+                        handle.promise().m_flag->set();
+                    }
+                    void await_resume() noexcept {}
+                };
+                return Notifier{};
+            }
+            void return_void() noexcept {}
+            void unhandled_exception() noexcept { std::terminate(); } // The task's exception is captured below
+        };
+
+        std::coroutine_handle<promise_type> m_handle;
+    };
+
+    // A coroutine function rather than a lambda: the parameters are copied
+    // into the frame, where lambda captures would dangle.
+    template <typename T, typename Result>
+    SyncWaitTask makeSyncWaitTask(Task<T> &task, Result &result, std::exception_ptr &exception)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                co_await std::move(task);
+                result.emplace();
+            }
+            else
+                result.emplace(co_await std::move(task));
+        }
+        catch (...)
+        {
+            exception = std::current_exception();
+        }
+    }
+}
+
+// Runs the task to completion and returns its result (or rethrows its
+// exception). The calling thread parks until then, it does not spin.
+template <typename T>
+T sync_wait(Task<T> task)
+{
+    std::exception_ptr exception;
+    std::optional<std::conditional_t<std::is_void_v<T>, char, T>> result;
+
+    auto waiter = detail::makeSyncWaitTask(task, result, exception);
+
+    CompletionFlag flag;
+    waiter.m_handle.promise().m_flag = &flag;
+    waiter.m_handle.resume();
+    flag.wait();
+    waiter.m_handle.destroy();
+
+    if (exception)
+        std::rethrow_exception(exception);
+    if constexpr (!std::is_void_v<T>)
+        return std::move(*result);
+}
+
+namespace detail
+{
+    template <typename T>
+    using TimeoutResult = std::conditional_t<std::is_void_v<T>, bool, std::optional<T>>;
+
+    // Shared by the coroutine awaiting with_timeout, the task and the timer;
+    // whichever of the last two claims it first resumes the first.
+    template <typename T>
+    struct TimeoutState
+    {
+        std::atomic<bool> claimed{false};
+        std::coroutine_handle<> awaiting;
+        TimeoutResult<T> result{};
+        std::exception_ptr exception;
+        AwaiterNode timer; // The timer's sleep, in the Thread's wheel
+
+        bool claim() { return !claimed.exchange(true, std::memory_order_acq_rel); }
+    };
+
+    // Run by the task when it wins: wakes the timer on its thread, so that
+    // the timer's frame, and the state, do not linger until the deadline
+    template <typename T>
+    task cancelTimeoutTimer(Thread &thread, std::shared_ptr<TimeoutState<T>> state)
+    {
+        co_await thread;
+        thread.wake(state->timer);
+    }
+
+    template <typename T>
+    task runTimeoutTask(Thread &thread, Task<T> work, std::shared_ptr<TimeoutState<T>> state)
+    {
+        try
+        {
+            if constexpr (std::is_void_v<T>)
+            {
+                co_await std::move(work);
+                if (state->claim())
+                {
+                    state->result = true;
+                    cancelTimeoutTimer(thread, state);
+                    state->awaiting.resume();
+                }
+            }
+            else
+            {
+                auto value = co_await std::move(work);
+                if (state->claim())
+                {
+                    state->result.emplace(std::move(value));
+                    cancelTimeoutTimer(thread, state);
+                    state->awaiting.resume();
+                }
+            }
+        }
+        catch (...)
+        {
+            if (state->claim())
+            {
+                state->exception = std::current_exception();
+                cancelTimeoutTimer(thread, state);
+                state->awaiting.resume();
+            }
+        }
+    }
+
+    template <typename T>
+    task runTimeoutTimer(Thread &thread, AwaiterNode::Clock::time_point deadline, std::shared_ptr<TimeoutState<T>> state)
+    {
+        // Like co_await thread.sleep_until(deadline), but with the node where
+        // cancelTimeoutTimer can find it
+        struct Sleep
+        {
+            Thread &thread;
+            AwaiterNode &node;
+            bool await_ready() { return false; }
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                node.m_handle = handle;
+                thread.schedule(node);
+            }
+            void await_resume() {}
+        };
+        state->timer.m_deadline = std::max(deadline, AwaiterNode::Clock::time_point{} + AwaiterNode::Clock::duration{1});
+        co_await Sleep{thread, state->timer};
+        if (state->claim())
+            state->awaiting.resume();
+    }
+
+    template <typename T>
+    struct TimeoutAwaitable
+    {
+        Thread &thread;
+        Task<T> &work;
+        AwaiterNode::Clock::time_point deadline;
+        std::shared_ptr<TimeoutState<T>> &state;
+
+        bool await_ready() { return false; }
+
+        void await_suspend(std::coroutine_handle<> handle)
+        {
+            // Either coroutine may resume us, and end this awaitable, at once
+            state->awaiting = handle;
+            auto timerState = state;
+            auto workState = state;
+            Task<T> started = std::move(work);
+            Thread &timerThread = thread;
+            runTimeoutTimer(timerThread, deadline, std::move(timerState));
+            runTimeoutTask(timerThread, std::move(started), std::move(workState));
+        }
+
+        void await_resume() {}
+    };
+}
+
+// Awaits the task for at most the given time, as measured on the thread.
+// Produces the task's value, or std::nullopt on timeout (for Task<void>,
+// whether it finished in time). A timed-out task is not cancelled: it runs
+// on, detached, and its result is dropped. On timeout the awaiting
+// coroutine continues on the thread, otherwise where the task finished.
+template <typename T, typename Rep, typename Period>
+Task<detail::TimeoutResult<T>> with_timeout(Thread &thread, Task<T> work, std::chrono::duration<Rep, Period> timeout)
+{
+    auto deadline = AwaiterNode::Clock::now() + std::chrono::ceil<AwaiterNode::Clock::duration>(timeout);
+    auto state = std::make_shared<detail::TimeoutState<T>>();
+    co_await detail::TimeoutAwaitable<T>{thread, work, deadline, state};
+    if (state->exception)
+        std::rethrow_exception(state->exception);
+    co_return std::move(state->result);
+}
+
+Task<> f(Thread &thread1, Thread &thread2)
 {
     co_await thread1;
     display("This is the thread1");
 
     co_await thread2;
     display("This is the thread2");
-    done = true;
 }
 
+Task<> g(CoroThreadPool &pool)
+{
+    co_await pool.schedule();
+    display("This is a pool worker");
+
+    co_await pool.schedule_on(0);
+    display("This is pool worker 0");
+}
+
+#ifndef NO_DEMO_MAIN
 int main()
 {
     std::chrono::system_clock::time_point start = std::chrono::system_clock::now();
     Thread a, b;
     display("This is the main thread");
-    f(a, b);
-    while (!done)
-        ;
+    sync_wait(f(a, b));
+
+    CoroThreadPool pool;
+    sync_wait(g(pool));
     auto end = std::chrono::system_clock::now();
     auto diff = std::chrono::duration_cast < std::chrono::milliseconds > (end - start).count();
     std::cout << "\nTotal Time Taken = " << diff << " MilliSeconds" << std::endl;
 
     return 0;
 }
+#endif // NO_DEMO_MAIN
@@ -16,15 +16,36 @@
 #include <vector>
 #include <tuple>
 #include <atomic>
+#include <deque>
+#include <algorithm>
 
 
 using namespace std;
 template <class T>
 struct _state
 {
-    std::mutex mtx;
-    std::condition_variable cv;
+    // Ready while the promise is still signalling, Done once it no longer
+    // touches the state, so the waiter may let it go out of scope
+    enum : int { Empty, Ready, Done };
+    std::atomic<int> flag{Empty};
     std::variant<std::monostate, std::exception_ptr, T> data;
+
+    void signal() noexcept
+    {
+        flag.store(Ready, std::memory_order_release);
+        flag.notify_one();
+        flag.store(Done, std::memory_order_release);
+    }
+    void wait() noexcept
+    {
+        for (int s = flag.load(std::memory_order_acquire); s != Done; s = flag.load(std::memory_order_acquire))
+        {
+            if (s == Empty)
+                flag.wait(Empty, std::memory_order_acquire);
+            else
+                std::this_thread::yield();
+        }
+    }
 };
 
 template <class T>
@@ -34,26 +55,28 @@ struct _promise
     template <int I>
     void _set(auto... xs)
     {
-        auto lk = std::unique_lock{pst->mtx};
         pst->data.template emplace<I>(xs...);
-        pst->cv.notify_one();
+        pst->signal();
     }
     void set_value(auto... vs) { _set<2>(vs...); }
     void set_exception(auto e) { _set<1>(e); }
 };
 
+// Local classes cannot have member templates, so then's promise lives here
+template <class P, class Fun>
+struct _then_promise
+{
+    P p_;
+    Fun fun_;
+    // void set_value(int vs) { p_.set_value((vs)); }
+    void set_value(auto... vs) { p_.set_value(fun_(vs...)); }
+    void set_exception(auto e) { p_.set_exception(e); }
+};
+
 auto then(auto task, auto fun)
 {
     return [=](auto p) {
-        struct _promise
-        {
-            decltype(p) p_;
-            decltype(fun) fun_;
-            // void set_value(int vs) { p_.set_value((vs)); }
-            void set_value(auto... vs) { p_.set_value(fun_(vs...)); }
-            void set_exception(exception _e) { p_.set_exception(_e); }
-        };
-        task(_promise{p, fun});
+        task(_then_promise<decltype(p), decltype(fun)>{p, fun});
     };
 }
 
@@ -64,10 +87,7 @@ T sync_wait(Task task)
     // launch the operation:
     task(_promise<T>{&state});
     // wait for it to finish:
-    {
-        auto lk = std::unique_lock{state.mtx};
-        state.cv.wait(lk, [&state] { return state.data.index() != 0; });
-    }
+    state.wait();
     // throw or return the result:
     if (state.data.index() == 1)
         std::rethrow_exception(get<1>(state.data));
@@ -84,6 +104,83 @@ auto new_thread()
     };
 }
 
+// A bounded set of workers, shared by every pool_scheduler() task
+class _task_pool
+{
+public:
+    explicit _task_pool(std::size_t n)
+    {
+        for (std::size_t i = 0; i < n; ++i)
+            workers.emplace_back([this] { work(); });
+    }
+    ~_task_pool()
+    {
+        {
+            auto lk = std::unique_lock{mtx};
+            stopping = true;
+        }
+        cv.notify_all();
+        for (auto &t : workers)
+            t.join();
+    }
+    void submit(std::function<void()> f)
+    {
+        {
+            auto lk = std::unique_lock{mtx};
+            queue.push_back(std::move(f));
+        }
+        cv.notify_one();
+    }
+
+private:
+    void work()
+    {
+        for (;;)
+        {
+            std::function<void()> f;
+            {
+                auto lk = std::unique_lock{mtx};
+                cv.wait(lk, [this] { return stopping || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                f = std::move(queue.front());
+                queue.pop_front();
+            }
+            f();
+        }
+    }
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> queue;
+    bool stopping = false;
+    std::vector<std::thread> workers;
+};
+
+inline _task_pool &_default_pool()
+{
+    static _task_pool pool{std::max(1u, std::thread::hardware_concurrency())};
+    return pool;
+}
+
+// Drop-in for new_thread(), running on the shared pool instead of a
+// thread of its own
+auto pool_scheduler()
+{
+    return [](auto p) {
+        _default_pool().submit([p]() mutable {
+            try
+            {
+                p.set_value();
+            }
+            catch (...)
+            {
+                p.set_exception(std::current_exception());
+            }
+        });
+    };
+}
+
 auto async_algo(auto task)
 {
     return then(task, []() { return 6 + rand(); });
@@ -91,7 +188,7 @@ auto async_algo(auto task)
 
 int main()
 {
-    auto f = async_algo(new_thread());
+    auto f = async_algo(pool_scheduler());
     auto f2 = then(f, [](int i) { return i + rand(); });
     printf("%d\n", sync_wait<int>(f2));
 }
\ No newline at end of file
@@ -5,14 +5,22 @@
 #include <exception>
 #include <stdexcept>
 #include <type_traits>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
 #include "all_prop.cpp"
+#include "RunQueue.h"
 
+// A run loop for senders. The operation state is the queue node, so
+// scheduling allocates nothing. Any thread may start operations on it, and
+// any number of threads may drain() or run() it; tasks execute in the
+// order they were started.
 class simple_execution_context
 {
     struct task_base
     {
         virtual void execute() noexcept = 0;
-        task_base *next;
+        task_base *next = nullptr;
     };
     class schedule_sender
     {
@@ -39,7 +47,7 @@ class simple_execution_context
 
         public:
             explicit operation_state(simple_execution_context &ctx, Receiver &&r) : ctx(ctx), receiver((Receiver &&) r) {}
-            void start() noexcept & { ctx.enqueue(this); }
+            void start() & noexcept { ctx.enqueue(this); }
         };
         // Returns the operation-state object to the caller which is responsible for
         // ensuring it remains alive until the operation completes once start() is called.
@@ -63,13 +71,31 @@ public:
     // Processes all pending tasks until the queue is empty.
     void drain() noexcept
     {
-        while (head != nullptr)
-        {
-            task_base *t = std::exchange(head, head->next);
+        while (task_base *t = queue.pop())
             t->execute();
+    }
+    // Processes tasks as they arrive, sleeping while there are none,
+    // until stop() is called.
+    void run() noexcept
+    {
+        while (!queue.stopped())
+        {
+            if (task_base *t = queue.pop())
+                t->execute();
+            else
+                queue.park();
         }
     }
+    // Makes every run() return once it is done with its current task.
+    // Whatever is still queued stays there for a later drain().
+    void stop() noexcept
+    {
+        queue.stop();
+    }
 private:
-    void enqueue(task_base *t) noexcept { t->next = std::exchange(head, t); }
-    task_base *head = nullptr;
-};
\ No newline at end of file
+    void enqueue(task_base *t) noexcept
+    {
+        queue.push(t);
+    }
+    RunQueue<task_base> queue;
+};
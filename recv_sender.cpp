@@ -3,10 +3,22 @@
 #include <tuple>
 #include <new>
 #include <optional>
+#include <random>
 #include <exception>
 #include <concepts>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
 
 extern "C" int puts(char const*) noexcept;
+extern "C" int printf(char const*, ...) noexcept;
 using std::invoke_result_t;
 
 // C++20 concepts
@@ -102,6 +114,14 @@ concept sender =
 
 static_assert(!sender<int>);
 
+// The values a sender completes with, as Tuple<As...>. Senders that
+// adaptors need to store the results of declare them, e.g.
+//   template<template<class...> class Tuple>
+//   using value_types = Tuple<int>;
+template<class S, template<class...> class Tuple>
+using value_types_of_t =
+    typename std::remove_cvref_t<S>::template value_types<Tuple>;
+
 inline namespace _sender_cpos_ {
     inline constexpr struct _start_fn_ {
         template<class O>
@@ -187,6 +207,9 @@ struct _retry_sender : sender_base {
     S s_;
     explicit _retry_sender(S s): s_((S&&) s) {}
 
+    template<template<class...> class Tuple>
+    using value_types = value_types_of_t<S, Tuple>;
+
     // Hold the nested operation state in an optional so we can
     // re-construct and re-start it when the operation fails.
     template<receiver R>
@@ -229,6 +252,567 @@ sender auto retry(S s) {
 // retry algorithm implementation ends here
 /////////////////////////////////////////////////////////////////////////
 
+/////////////////////////////////////////////////////////////////////////
+// retry_with algorithm implementation begins here
+
+// How many times retry_with tries, and how long it waits in between:
+// exponential backoff, capped, with part of each delay taken off at random
+// so that clients failing together do not all come back together.
+struct retry_policy {
+    int max_attempts = 5; // including the first one
+    std::chrono::milliseconds initial_delay{10};
+    double multiplier = 2.0;
+    std::chrono::milliseconds max_delay{1000};
+    double jitter = 0.5; // fraction of the delay that may be taken off
+
+    // The wait before the given attempt; 2 is the first retry
+    std::chrono::nanoseconds delay(int attempt) const {
+        using ns = std::chrono::duration<double, std::nano>;
+        const double max = ns(max_delay).count();
+        double d = ns(initial_delay).count();
+        for(int i = 2; i < attempt && d < max; ++i)
+            d *= multiplier;
+        thread_local std::minstd_rand rng{std::random_device{}()};
+        d = std::min(d, max) *
+            (1.0 - jitter * std::uniform_real_distribution<double>{}(rng));
+        return std::chrono::nanoseconds(static_cast<std::int64_t>(d));
+    }
+};
+
+template<class Sch>
+using _schedule_after_result_t =
+    decltype(std::declval<Sch&>().schedule_after(std::chrono::nanoseconds{}));
+
+template<class O, class R>
+struct _retry_with_receiver {
+    O* o_;
+    template<class... As>
+    void set_value(As&&... as) && {
+        ::set_value(std::move(o_->r_), (As&&) as...);
+    }
+    template<class E>
+        requires receiver<R, E>
+    void set_error(E&& e) && noexcept {
+        o_->_failed((E&&) e);
+    }
+    void set_done() && noexcept {
+        ::set_done(std::move(o_->r_));
+    }
+};
+
+template<class O, class R>
+struct _retry_timer_receiver {
+    O* o_;
+    void set_value() && noexcept {
+        o_->_attempt();
+    }
+    template<class E>
+        requires receiver<R, E>
+    void set_error(E&& e) && noexcept {
+        ::set_error(std::move(o_->r_), (E&&) e);
+    }
+    void set_done() && noexcept {
+        ::set_done(std::move(o_->r_));
+    }
+};
+
+// Like retry, but every retry is started from sch.schedule_after(delay).
+// That bounds the stack however the sender fails, since the failing
+// attempt only arms a timer and returns, and it spares a failing backend.
+// Once max_attempts have failed the last error is passed on.
+template<sender S, class Sch>
+struct _retry_with_sender : sender_base {
+    S s_;
+    Sch sch_;
+    retry_policy policy_;
+    _retry_with_sender(S s, Sch sch, retry_policy policy)
+        : s_((S&&) s), sch_((Sch&&) sch), policy_(policy) {}
+
+    template<template<class...> class Tuple>
+    using value_types = value_types_of_t<S, Tuple>;
+
+    template<receiver R>
+    struct _op {
+        using _receiver_t = _retry_with_receiver<_op, R>;
+        using _timer_receiver_t = _retry_timer_receiver<_op, R>;
+
+        S s_;
+        Sch sch_;
+        retry_policy policy_;
+        R r_;
+        int attempts_ = 0;
+        // Attempts alternate between two slots, so an attempt is never
+        // destroyed by the very next one, which its timer may start
+        // before its set_error has quite returned
+        std::optional<state_t<S&, _receiver_t>> o_[2];
+        std::optional<state_t<_schedule_after_result_t<Sch>, _timer_receiver_t>> timer_;
+
+        _op(S s, Sch sch, retry_policy policy, R r)
+            : s_((S&&) s), sch_((Sch&&) sch), policy_(policy), r_((R&&) r) {}
+        _op(_op&&) = delete;
+
+        void _attempt() noexcept try {
+            auto& o = o_[attempts_++ % 2];
+            o.emplace(_conv{[this] {
+                return ::connect(s_, _receiver_t{this});
+            }});
+            ::start(std::move(*o));
+        } catch(...) {
+            ::set_error((R&&) r_, std::current_exception());
+        }
+
+        template<class E>
+        void _failed(E&& e) noexcept {
+            if(attempts_ >= policy_.max_attempts) {
+                ::set_error((R&&) r_, (E&&) e);
+                return;
+            }
+            // This may replace the timer whose completion started the
+            // failing attempt; timer operations touch nothing of themselves
+            // once they have completed.
+            try {
+                timer_.emplace(_conv{[this] {
+                    return ::connect(sch_.schedule_after(policy_.delay(attempts_ + 1)),
+                                     _timer_receiver_t{this});
+                }});
+            } catch(...) {
+                ::set_error((R&&) r_, std::current_exception());
+                return;
+            }
+            ::start(std::move(*timer_));
+        }
+
+        void start() && noexcept {
+            _attempt();
+        }
+    };
+
+    template<receiver R>
+        requires sender_to<S&, _retry_with_receiver<_op<R>, R>> &&
+            sender_to<_schedule_after_result_t<Sch>, _retry_timer_receiver<_op<R>, R>>
+    auto connect(R r) && -> _op<R> {
+        return _op<R>{(S&&) s_, (Sch&&) sch_, policy_, (R&&) r};
+    }
+};
+
+template<sender S, class Sch>
+sender auto retry_with(S s, Sch sch, retry_policy policy = {}) {
+    return _retry_with_sender<S, Sch>{(S&&) s, (Sch&&) sch, policy};
+}
+
+// retry_with algorithm implementation ends here
+/////////////////////////////////////////////////////////////////////////
+
+/////////////////////////////////////////////////////////////////////////
+// sender algorithms begin here
+//
+// Each adaptor connects its children inside its own operation state, so
+// connecting a whole pipeline yields a single object and running it
+// allocates nothing.
+
+template<class... As>
+using _decayed_tuple = std::tuple<std::decay_t<As>...>;
+
+template<class... As>
+struct _type_list {};
+
+template<class... As>
+using _decayed_type_list = _type_list<std::decay_t<As>...>;
+
+// Tuple<As..., Bs..., ...> from _type_list<As...>, _type_list<Bs...>, ...
+template<template<class...> class Tuple, class... Lists>
+struct _concat;
+template<template<class...> class Tuple, class... As>
+struct _concat<Tuple, _type_list<As...>> {
+    using type = Tuple<As...>;
+};
+template<template<class...> class Tuple, class... As, class... Bs, class... Rest>
+struct _concat<Tuple, _type_list<As...>, _type_list<Bs...>, Rest...>
+    : _concat<Tuple, _type_list<As..., Bs...>, Rest...> {};
+
+// Receivers that only intercept set_value forward the other two
+// signals to the receiver at r_ (or o_->r_ when holding the parent).
+#define _FORWARD_ERROR_AND_DONE(R, r)                           \
+    template<class E>                                           \
+        requires receiver<R, E>                                 \
+    void set_error(E&& e) && noexcept {                         \
+        ::set_error((R&&) r, (E&&) e);                          \
+    }                                                           \
+    void set_done() && noexcept {                               \
+        ::set_done((R&&) r);                                    \
+    }
+
+// then(s, f): completes with f(as...), or with nothing if f returns void
+
+template<template<class...> class Tuple, class T>
+struct _then_values_ { using type = Tuple<T>; };
+template<template<class...> class Tuple>
+struct _then_values_<Tuple, void> { using type = Tuple<>; };
+
+template<class F, template<class...> class Tuple>
+struct _then_values {
+    template<class... As>
+    using apply = typename _then_values_<Tuple, invoke_result_t<F, As...>>::type;
+};
+
+template<class R, class F>
+struct _then_receiver {
+    R r_;
+    F f_;
+    template<class... As>
+        requires invocable<F, As...>
+    void set_value(As&&... as) && {
+        if constexpr (std::is_void_v<invoke_result_t<F, As...>>) {
+            std::invoke((F&&) f_, (As&&) as...);
+            ::set_value((R&&) r_);
+        } else {
+            ::set_value((R&&) r_, std::invoke((F&&) f_, (As&&) as...));
+        }
+    }
+    _FORWARD_ERROR_AND_DONE(R, r_)
+};
+
+template<sender S, class F>
+struct _then_sender : sender_base {
+    S s_;
+    F f_;
+    _then_sender(S s, F f): s_((S&&) s), f_((F&&) f) {}
+
+    template<template<class...> class Tuple>
+    using value_types =
+        value_types_of_t<S, _then_values<F, Tuple>::template apply>;
+
+    template<receiver R>
+        requires sender_to<S, _then_receiver<R, F>>
+    auto connect(R r) && {
+        return ::connect((S&&) s_, _then_receiver<R, F>{(R&&) r, (F&&) f_});
+    }
+    // So that then(s, f) can be retried
+    template<receiver R>
+        requires sender_to<S&, _then_receiver<R, F>>
+    auto connect(R r) & {
+        return ::connect(s_, _then_receiver<R, F>{(R&&) r, f_});
+    }
+};
+
+template<sender S, class F>
+sender auto then(S s, F f) {
+    return _then_sender<S, F>{(S&&) s, (F&&) f};
+}
+
+// bulk(s, n, f): calls f(i, as...) for i in [0, n), then passes as... on
+
+template<class R, class F>
+struct _bulk_receiver {
+    R r_;
+    F f_;
+    std::size_t n_;
+    template<class... As>
+        requires invocable<F&, std::size_t, As&...>
+    void set_value(As&&... as) && {
+        for(std::size_t i = 0; i < n_; ++i)
+            std::invoke(f_, i, as...);
+        ::set_value((R&&) r_, (As&&) as...);
+    }
+    _FORWARD_ERROR_AND_DONE(R, r_)
+};
+
+template<sender S, class F>
+struct _bulk_sender : sender_base {
+    S s_;
+    std::size_t n_;
+    F f_;
+    _bulk_sender(S s, std::size_t n, F f): s_((S&&) s), n_(n), f_((F&&) f) {}
+
+    template<template<class...> class Tuple>
+    using value_types = value_types_of_t<S, Tuple>;
+
+    template<receiver R>
+        requires sender_to<S, _bulk_receiver<R, F>>
+    auto connect(R r) && {
+        return ::connect((S&&) s_, _bulk_receiver<R, F>{(R&&) r, (F&&) f_, n_});
+    }
+    template<receiver R>
+        requires sender_to<S&, _bulk_receiver<R, F>>
+    auto connect(R r) & {
+        return ::connect(s_, _bulk_receiver<R, F>{(R&&) r, f_, n_});
+    }
+};
+
+template<sender S, class F>
+sender auto bulk(S s, std::size_t n, F f) {
+    return _bulk_sender<S, F>{(S&&) s, n, (F&&) f};
+}
+
+// transfer(s, sch): completes with the values of s, but from a
+// sch.schedule() started once s has completed
+
+template<class Sch>
+using _schedule_result_t = decltype(std::declval<Sch&>().schedule());
+
+template<class S, class Sch, class R>
+struct _transfer_op {
+    struct _value_receiver {
+        _transfer_op* o_;
+        template<class... As>
+        void set_value(As&&... as) && noexcept {
+            try {
+                o_->values_.emplace((As&&) as...);
+            } catch(...) {
+                ::set_error((R&&) o_->r_, std::current_exception());
+                return;
+            }
+            ::start(std::move(o_->sched_op_));
+        }
+        _FORWARD_ERROR_AND_DONE(R, o_->r_)
+    };
+    struct _sched_receiver {
+        _transfer_op* o_;
+        void set_value() && {
+            std::apply([this](auto&... vs) {
+                ::set_value((R&&) o_->r_, std::move(vs)...);
+            }, *o_->values_);
+        }
+        _FORWARD_ERROR_AND_DONE(R, o_->r_)
+    };
+
+    R r_;
+    std::optional<value_types_of_t<S, _decayed_tuple>> values_;
+    state_t<_schedule_result_t<Sch>, _sched_receiver> sched_op_;
+    state_t<S, _value_receiver> op_;
+
+    _transfer_op(S&& s, Sch& sch, R r)
+        : r_((R&&) r)
+        , sched_op_(::connect(sch.schedule(), _sched_receiver{this}))
+        , op_(::connect((S&&) s, _value_receiver{this})) {}
+    _transfer_op(_transfer_op&&) = delete;
+
+    void start() && noexcept {
+        ::start(std::move(op_));
+    }
+};
+
+template<sender S, class Sch>
+struct _transfer_sender : sender_base {
+    S s_;
+    Sch sch_;
+    _transfer_sender(S s, Sch sch): s_((S&&) s), sch_((Sch&&) sch) {}
+
+    template<template<class...> class Tuple>
+    using value_types =
+        typename _concat<Tuple, value_types_of_t<S, _decayed_type_list>>::type;
+
+    template<receiver R>
+    auto connect(R r) && -> _transfer_op<S, Sch, R> {
+        return _transfer_op<S, Sch, R>{(S&&) s_, sch_, (R&&) r};
+    }
+};
+
+template<sender S, class Sch>
+sender auto transfer(S s, Sch sch) {
+    return _transfer_sender<S, Sch>{(S&&) s, (Sch&&) sch};
+}
+
+// when_all(ss...): starts every ss, then completes with all of their
+// values in order; the first error or done wins if any fails. The last
+// child in counts the rest down, so no lock is needed.
+
+template<class R, class Is, class... Ss>
+struct _when_all_op;
+
+template<class R, std::size_t... Is, class... Ss>
+struct _when_all_op<R, std::index_sequence<Is...>, Ss...> {
+    enum : int { _running, _failed, _cancelled };
+
+    template<std::size_t I>
+    struct _receiver {
+        _when_all_op* o_;
+        template<class... As>
+        void set_value(As&&... as) && noexcept {
+            try {
+                std::get<I>(o_->values_).emplace((As&&) as...);
+            } catch(...) {
+                o_->_settle(_failed, std::current_exception());
+            }
+            o_->_arrive();
+        }
+        template<class E>
+        void set_error(E&& e) && noexcept {
+            if constexpr (std::is_same_v<std::decay_t<E>, std::exception_ptr>)
+                o_->_settle(_failed, (E&&) e);
+            else
+                o_->_settle(_failed, std::make_exception_ptr((E&&) e));
+            o_->_arrive();
+        }
+        void set_done() && noexcept {
+            o_->_settle(_cancelled, nullptr);
+            o_->_arrive();
+        }
+    };
+
+    R r_;
+    std::tuple<std::optional<value_types_of_t<Ss, _decayed_tuple>>...> values_;
+    std::exception_ptr error_;
+    std::atomic<std::size_t> count_{sizeof...(Ss)};
+    std::atomic<int> status_{_running};
+    std::tuple<state_t<Ss, _receiver<Is>>...> ops_;
+
+    _when_all_op(R r, std::tuple<Ss...>&& ss)
+        : r_((R&&) r)
+        , ops_{_conv{[&, this] {
+              return ::connect((Ss&&) std::get<Is>(ss), _receiver<Is>{this});
+          }}...} {}
+    _when_all_op(_when_all_op&&) = delete;
+
+    // Only the first child to fail gets to record why. The write is
+    // published by that child's countdown in _arrive.
+    void _settle(int status, std::exception_ptr e) noexcept {
+        int running = _running;
+        if(status_.compare_exchange_strong(running, status, std::memory_order_relaxed))
+            error_ = std::move(e);
+    }
+
+    void _arrive() noexcept {
+        if(count_.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            _complete();
+    }
+
+    void _complete() noexcept {
+        switch(status_.load(std::memory_order_relaxed)) {
+        case _running:
+            try {
+                std::apply([this](auto&&... vs) {
+                    ::set_value((R&&) r_, std::move(vs)...);
+                }, std::tuple_cat(std::move(*std::get<Is>(values_))...));
+            } catch(...) {
+                ::set_error((R&&) r_, std::current_exception());
+            }
+            break;
+        case _failed:
+            ::set_error((R&&) r_, std::move(error_));
+            break;
+        default:
+            ::set_done((R&&) r_);
+        }
+    }
+
+    void start() && noexcept {
+        if constexpr (sizeof...(Ss) == 0)
+            _complete();
+        else
+            (::start(std::move(std::get<Is>(ops_))), ...);
+    }
+};
+
+template<sender... Ss>
+struct _when_all_sender : sender_base {
+    std::tuple<Ss...> ss_;
+    explicit _when_all_sender(Ss... ss): ss_((Ss&&) ss...) {}
+
+    template<template<class...> class Tuple>
+    using value_types = typename _concat<
+        Tuple, _type_list<>, value_types_of_t<Ss, _decayed_type_list>...>::type;
+
+    template<receiver R>
+    auto connect(R r) && -> _when_all_op<R, std::index_sequence_for<Ss...>, Ss...> {
+        return _when_all_op<R, std::index_sequence_for<Ss...>, Ss...>{
+            (R&&) r, std::move(ss_)};
+    }
+};
+
+template<sender... Ss>
+sender auto when_all(Ss... ss) {
+    return _when_all_sender<Ss...>{(Ss&&) ss...};
+}
+
+// let_value(s, f): keeps the values of s alive in the operation state,
+// and continues with the sender f(as&...) returns
+
+template<class F, class Tuple>
+struct _apply_result;
+template<class F, class... Vs>
+struct _apply_result<F, std::tuple<Vs...>> {
+    using type = std::remove_cvref_t<invoke_result_t<F, Vs&...>>;
+};
+
+template<class S, class F>
+using _let_sender_t =
+    typename _apply_result<F&, value_types_of_t<S, _decayed_tuple>>::type;
+
+template<class S, class F, class R>
+struct _let_op {
+    struct _inner_receiver {
+        _let_op* o_;
+        template<class... As>
+            requires receiver_of<R, As...>
+        void set_value(As&&... as) &&
+            noexcept(is_nothrow_receiver_of_v<R, As...>) {
+            ::set_value((R&&) o_->r_, (As&&) as...);
+        }
+        _FORWARD_ERROR_AND_DONE(R, o_->r_)
+    };
+    struct _outer_receiver {
+        _let_op* o_;
+        template<class... As>
+        void set_value(As&&... as) && noexcept {
+            o_->_continue((As&&) as...);
+        }
+        _FORWARD_ERROR_AND_DONE(R, o_->r_)
+    };
+
+    R r_;
+    F f_;
+    std::optional<value_types_of_t<S, _decayed_tuple>> values_;
+    std::optional<state_t<_let_sender_t<S, F>, _inner_receiver>> op2_;
+    state_t<S, _outer_receiver> op_;
+
+    _let_op(S&& s, F f, R r)
+        : r_((R&&) r)
+        , f_((F&&) f)
+        , op_(::connect((S&&) s, _outer_receiver{this})) {}
+    _let_op(_let_op&&) = delete;
+
+    template<class... As>
+    void _continue(As&&... as) noexcept try {
+        values_.emplace((As&&) as...);
+        op2_.emplace(_conv{[this] {
+            return ::connect(std::apply(f_, *values_), _inner_receiver{this});
+        }});
+        ::start(std::move(*op2_));
+    } catch(...) {
+        ::set_error((R&&) r_, std::current_exception());
+    }
+
+    void start() && noexcept {
+        ::start(std::move(op_));
+    }
+};
+
+template<sender S, class F>
+struct _let_value_sender : sender_base {
+    S s_;
+    F f_;
+    _let_value_sender(S s, F f): s_((S&&) s), f_((F&&) f) {}
+
+    template<template<class...> class Tuple>
+    using value_types = value_types_of_t<_let_sender_t<S, F>, Tuple>;
+
+    template<receiver R>
+    auto connect(R r) && -> _let_op<S, F, R> {
+        return _let_op<S, F, R>{(S&&) s_, (F&&) f_, (R&&) r};
+    }
+};
+
+template<sender S, class F>
+sender auto let_value(S s, F f) {
+    return _let_value_sender<S, F>{(S&&) s, (F&&) f};
+}
+
+#undef _FORWARD_ERROR_AND_DONE
+
+// sender algorithms end here
+/////////////////////////////////////////////////////////////////////////
+
 inline constexpr struct _sink {
     void set_value(auto&&...) const noexcept {}
     [[noreturn]] void set_error(auto&&) const noexcept {
@@ -244,6 +828,9 @@ inline constexpr struct _sink {
 struct fail_3 : sender_base {
     int count_ = 0;
 
+    template<template<class...> class Tuple>
+    using value_types = Tuple<int>;
+
     template<receiver_of R>
     struct _op {
         int const count_;
@@ -270,9 +857,405 @@ struct fail_3 : sender_base {
     }
 };
 
+/////////////////////////////////////////////////////////////////////////
+// static_thread_pool implementation begins here
+
+// A fixed set of worker threads with one lock-free queue per worker.
+// scheduler().schedule() is a sender whose operation state is itself the
+// queue node, so scheduling work allocates nothing; the receiver gets
+// set_value() on a pool thread, or set_done() once the pool has stopped.
+// scheduler().schedule_after(d) does the same once d has passed; a timer
+// thread keeps those in a list ordered by deadline until they are due.
+class static_thread_pool {
+    using _clock = std::chrono::steady_clock;
+
+    // Intrusive node of the work queues
+    struct _task_base {
+        std::atomic<_task_base*> next_{nullptr};
+        void (*execute_)(_task_base*, bool stopped) noexcept = nullptr;
+    };
+
+    // Vyukov's multi-producer single-consumer queue. Whoever wants to
+    // consume from it, a worker, a thief or an attached thread, has to
+    // claim it first, so there is only ever one consumer at a time.
+    struct alignas(64) _queue {
+        std::atomic<_task_base*> head_;
+        alignas(64) _task_base* tail_;
+        _task_base stub_;
+        std::atomic<bool> claimed_{false};
+
+        _queue(): head_(&stub_), tail_(&stub_) {}
+
+        void push(_task_base* t) noexcept {
+            t->next_.store(nullptr, std::memory_order_relaxed);
+            head_.exchange(t, std::memory_order_acq_rel)->next_.store(t, std::memory_order_release);
+        }
+
+        bool try_claim() noexcept {
+            return !claimed_.load(std::memory_order_relaxed) &&
+                !claimed_.exchange(true, std::memory_order_acquire);
+        }
+        void unclaim() noexcept { claimed_.store(false, std::memory_order_release); }
+
+        // Claimer only. nullptr when empty or when a push is half done.
+        _task_base* pop() noexcept {
+            _task_base* tail = tail_;
+            _task_base* next = tail->next_.load(std::memory_order_acquire);
+            if(tail == &stub_) {
+                if(!next)
+                    return nullptr;
+                tail_ = tail = next;
+                next = next->next_.load(std::memory_order_acquire);
+            }
+            if(next) {
+                tail_ = next;
+                return tail;
+            }
+            if(tail != head_.load(std::memory_order_acquire))
+                return nullptr;
+            push(&stub_);
+            if((next = tail->next_.load(std::memory_order_acquire))) {
+                tail_ = next;
+                return tail;
+            }
+            return nullptr;
+        }
+    };
+
+    // Intrusive node of the timer list
+    struct _timer_base : _task_base {
+        _clock::duration delay_{};
+        _clock::time_point deadline_{};
+        _timer_base* timer_next_ = nullptr;
+    };
+
+    template<class R, class Base = _task_base>
+    struct _op : Base {
+        static_thread_pool* pool_;
+        R r_;
+        _op(static_thread_pool* pool, R r): pool_(pool), r_((R&&) r) {
+            this->execute_ = &_execute;
+        }
+        _op(static_thread_pool* pool, R r, _clock::duration delay)
+            : _op(pool, (R&&) r) {
+            this->delay_ = delay;
+        }
+        _op(_op&&) = delete;
+
+        static void _execute(_task_base* t, bool stopped) noexcept {
+            auto& op = *static_cast<_op*>(t);
+            if(stopped) {
+                ::set_done((R&&) op.r_);
+                return;
+            }
+            try {
+                ::set_value((R&&) op.r_);
+            } catch(...) {
+                ::set_error((R&&) op.r_, std::current_exception());
+            }
+        }
+        void start() && noexcept {
+            if constexpr (std::is_same_v<Base, _timer_base>)
+                pool_->_enqueue_at(this);
+            else
+                pool_->_enqueue(this);
+        }
+    };
+
+    struct _schedule_sender : sender_base {
+        static_thread_pool* pool_;
+
+        template<template<class...> class Tuple>
+        using value_types = Tuple<>;
+
+        template<receiver_of R>
+        auto connect(R r) const -> _op<R> {
+            return _op<R>{pool_, (R&&) r};
+        }
+    };
+
+    struct _schedule_after_sender : sender_base {
+        static_thread_pool* pool_;
+        _clock::duration delay_;
+
+        template<template<class...> class Tuple>
+        using value_types = Tuple<>;
+
+        template<receiver_of R>
+        auto connect(R r) const -> _op<R, _timer_base> {
+            return _op<R, _timer_base>{pool_, (R&&) r, delay_};
+        }
+    };
+
+    // The node of executor().execute(f), which has to allocate
+    template<class F>
+    struct _fn_task : _task_base {
+        F f_;
+        explicit _fn_task(F f): f_((F&&) f) { this->execute_ = &_execute; }
+        static void _execute(_task_base* t, bool stopped) noexcept {
+            std::unique_ptr<_fn_task> self{static_cast<_fn_task*>(t)};
+            if(!stopped)
+                std::invoke((F&&) self->f_); // An escaping exception terminates
+        }
+    };
+
+public:
+    class scheduler_type {
+        friend static_thread_pool;
+        static_thread_pool* pool_;
+        explicit scheduler_type(static_thread_pool* pool) noexcept: pool_(pool) {}
+    public:
+        _schedule_sender schedule() const noexcept { return {{}, pool_}; }
+        template<class Rep, class Period>
+        _schedule_after_sender schedule_after(std::chrono::duration<Rep, Period> d) const noexcept {
+            return {{}, pool_, std::chrono::duration_cast<_clock::duration>(d)};
+        }
+        _clock::time_point now() const noexcept { return _clock::now(); }
+        bool operator==(const scheduler_type&) const noexcept = default;
+    };
+
+    class executor_type {
+        friend static_thread_pool;
+        static_thread_pool* pool_;
+        explicit executor_type(static_thread_pool* pool) noexcept: pool_(pool) {}
+    public:
+        template<class F>
+            requires invocable<std::decay_t<F>&&>
+        void execute(F&& f) const {
+            pool_->_enqueue(new _fn_task<std::decay_t<F>>{(F&&) f});
+        }
+        bool operator==(const executor_type&) const noexcept = default;
+    };
+
+    // construction/destruction
+    explicit static_thread_pool(std::size_t num_threads)
+        : queues_(std::max<std::size_t>(num_threads, 1)) {
+        threads_.reserve(queues_.size());
+        for(std::size_t i = 0; i < queues_.size(); ++i)
+            threads_.emplace_back([this, i] { _run(i); });
+        timer_thread_ = std::thread{[this] { _run_timers(); }};
+    }
+
+    // nocopy
+    static_thread_pool(const static_thread_pool&) = delete;
+    static_thread_pool& operator=(const static_thread_pool&) = delete;
+
+    // stop accepting incoming work and wait for work to drain
+    ~static_thread_pool() {
+        stop();
+        wait();
+    }
+
+    // attach current thread to the thread pools list of worker threads;
+    // returns once the pool has finished, after stop() or wait()
+    void attach() { _run(npos_); }
+
+    // signal all work to complete: whatever is still queued, or scheduled
+    // from now on, gets set_done() instead of running
+    void stop() {
+        stopped_.store(true);
+        _wake_all();
+    }
+
+    // wait for all threads in the thread pool to complete, which they do
+    // once no work is queued or running any more
+    void wait() {
+        draining_.store(true);
+        _wake_all();
+        std::lock_guard lock{join_mutex_};
+        for(auto& thread : threads_)
+            if(thread.joinable())
+                thread.join();
+        if(timer_thread_.joinable())
+            timer_thread_.join();
+    }
+
+    // placeholder for a general approach to getting schedulers from
+    // standard contexts.
+    scheduler_type scheduler() noexcept { return scheduler_type{this}; }
+
+    // placeholder for a general approach to getting executors from
+    // standard contexts.
+    executor_type executor() noexcept { return executor_type{this}; }
+
+private:
+    static constexpr std::size_t npos_ = std::size_t(-1);
+    static inline thread_local static_thread_pool* current_ = nullptr;
+    static inline thread_local std::size_t current_index_ = npos_;
+
+    // state_ counts work queued, waiting on a timer or running, in steps
+    // of 2; bit 0 is set for good once the pool has finished, and work
+    // arriving then is completed right here as stopped
+    bool _admit(_task_base* t) noexcept {
+        if(state_.fetch_add(2) & 1) {
+            state_.fetch_sub(2);
+            t->execute_(t, true);
+            return false;
+        }
+        return true;
+    }
+
+    void _enqueue(_task_base* t) noexcept {
+        if(_admit(t))
+            _push(t);
+    }
+
+    void _enqueue_at(_timer_base* t) noexcept {
+        if(!_admit(t))
+            return;
+        t->deadline_ = _clock::now() + t->delay_;
+        bool first;
+        {
+            std::lock_guard lock{timer_mutex_};
+            _timer_base** link = &timers_;
+            while(*link && (*link)->deadline_ <= t->deadline_)
+                link = &(*link)->timer_next_;
+            t->timer_next_ = *link;
+            *link = t;
+            first = timers_ == t;
+        }
+        if(first)
+            timer_cv_.notify_one();
+    }
+
+    void _push(_task_base* t) noexcept {
+        const std::size_t index = current_ == this && current_index_ != npos_
+            ? current_index_
+            : next_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+        queued_.fetch_add(1);
+        queues_[index].push(t);
+        if(sleepers_.load() > 0) {
+            signal_.fetch_add(1);
+            signal_.notify_one();
+        }
+    }
+
+    _task_base* _take(std::size_t index) noexcept {
+        const std::size_t first = index == npos_ ? next_.load(std::memory_order_relaxed) : index;
+        for(std::size_t k = 0; k < queues_.size(); ++k) {
+            _queue& queue = queues_[(first + k) % queues_.size()];
+            if(!queue.try_claim())
+                continue;
+            _task_base* t = queue.pop();
+            queue.unclaim();
+            if(t) {
+                queued_.fetch_sub(1);
+                return t;
+            }
+        }
+        return nullptr;
+    }
+
+    void _run(std::size_t index) {
+        auto* previous = std::exchange(current_, this);
+        auto previous_index = std::exchange(current_index_, index);
+        for(;;) {
+            if(_task_base* t = _take(index)) {
+                t->execute_(t, stopped_.load());
+                state_.fetch_sub(2);
+                continue;
+            }
+            if(stopped_.load() || draining_.load()) {
+                std::uint64_t idle = 0;
+                if(state_.compare_exchange_strong(idle, 1))
+                    _wake_all(); // Finished: everyone can go
+                if(state_.load() & 1)
+                    break;
+            }
+            const auto signal = signal_.load();
+            sleepers_.fetch_add(1);
+            if(queued_.load() == 0 && !(state_.load() & 1) &&
+               !((stopped_.load() || draining_.load()) && state_.load() == 0))
+                signal_.wait(signal);
+            sleepers_.fetch_sub(1);
+        }
+        current_ = previous;
+        current_index_ = previous_index;
+    }
+
+    // Hands timers over to the workers when due, or all at once when
+    // stopped; they still count as work, so the pool cannot finish first
+    void _run_timers() {
+        std::unique_lock lock{timer_mutex_};
+        for(;;) {
+            const bool stopped = stopped_.load();
+            const auto now = _clock::now();
+            while(timers_ && (stopped || timers_->deadline_ <= now))
+                _push(std::exchange(timers_, timers_->timer_next_));
+            if(state_.load() & 1)
+                return;
+            if(timers_)
+                timer_cv_.wait_until(lock, timers_->deadline_);
+            else
+                timer_cv_.wait(lock);
+        }
+    }
+
+    void _wake_all() noexcept {
+        signal_.fetch_add(1);
+        signal_.notify_all();
+        { std::lock_guard lock{timer_mutex_}; }
+        timer_cv_.notify_one();
+    }
+
+    std::vector<_queue> queues_;
+    std::vector<std::thread> threads_;
+    std::thread timer_thread_;
+    std::mutex timer_mutex_;
+    std::condition_variable timer_cv_;
+    _timer_base* timers_ = nullptr;
+    std::mutex join_mutex_;
+    std::atomic<std::uint64_t> state_{0};
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> sleepers_{0};
+    std::atomic<std::size_t> next_{0};
+    std::atomic<std::uint32_t> signal_{0};
+    std::atomic<bool> stopped_{false};
+    std::atomic<bool> draining_{false};
+};
+
+// static_thread_pool implementation ends here
+/////////////////////////////////////////////////////////////////////////
+
+struct _print_receiver {
+    const char* what_;
+    void set_value() { ::puts(what_); }
+    void set_error(std::exception_ptr) noexcept { std::terminate(); }
+    void set_done() noexcept { ::puts("stopped"); }
+};
+
 int main() {
     fail_3 s;
     ::start(::connect(retry(s), sink));
+
+    static_thread_pool pool{4};
+    auto op = ::connect(pool.scheduler().schedule(), _print_receiver{"on the pool"});
+    ::start(std::move(op));
+    pool.executor().execute([] { ::puts("executed on the pool"); });
+
+    // A pipeline of adaptors is one operation state on the stack
+    auto sch = pool.scheduler();
+    auto work =
+        bulk(
+            let_value(
+                when_all(
+                    then(sch.schedule(), [] { return 6; }),
+                    transfer(retry(fail_3{}), sch)),
+                [sch](int a, int b) {
+                    return then(sch.schedule(), [=] { return a * b; });
+                }),
+            3, [](std::size_t i, int v) { ::printf("bulk %zu: %d\n", i, v); });
+    auto op2 = ::connect(std::move(work), sink);
+    ::start(std::move(op2));
+
+    // Backs off 1ms, 2ms and 4ms (less jitter) between the attempts
+    auto op3 = ::connect(
+        then(retry_with(fail_3{}, sch, {.initial_delay = std::chrono::milliseconds{1}}),
+             [](int i) { ::printf("attempt %d succeeded\n", i); }),
+        sink);
+    ::start(std::move(op3));
+
+    pool.wait();
 }
 
 
@@ -376,36 +1359,4 @@ class sink_receiver {
     };
 
 
-class static_thread_pool
-{
-  public:
-    using scheduler_type = see-below;
-    using executor_type = see-below;
-    
-    // construction/destruction
-    explicit static_thread_pool(std::size_t num_threads);
-    
-    // nocopy
-    static_thread_pool(const static_thread_pool&) = delete;
-    static_thread_pool& operator=(const static_thread_pool&) = delete;
-
-    // stop accepting incoming work and wait for work to drain
-    ~static_thread_pool();
-
-    // attach current thread to the thread pools list of worker threads
-    void attach();
-
-    // signal all work to complete
-    void stop();
-
-    // wait for all threads in the thread pool to complete
-    void wait();
-
-    // placeholder for a general approach to getting schedulers from 
-    // standard contexts.
-    scheduler_type scheduler() noexcept;
-
-    // placeholder for a general approach to getting executors from 
-    // standard contexts.
-    executor_type executor() noexcept;
-};
\ No newline at end of file
+// class static_thread_pool: implemented above main()
\ No newline at end of file
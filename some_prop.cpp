@@ -5,47 +5,149 @@
 #include <exception>
 #include <stdexcept>
 #include <coroutine>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
 
+#include "RunQueue.h"
+#include "SchedStats.h"
 
+
+// A run loop for coroutines. Scheduling onto it still allocates nothing:
+// the awaiter lives in the awaiting coroutine's frame and is itself the
+// queue node. Any thread may schedule onto it, and any number of threads
+// may drain() or run() it; awaiters are resumed in the order they arrived.
+// A coroutine that reschedules itself from a thread draining the context
+// hands over to the next awaiter in line by symmetric transfer, without
+// returning to the drain loop, so a long chain of co_awaits neither grows
+// the stack nor costs a trip back out.
 class simple_execution_context {
     class awaiter {
         friend simple_execution_context;
+        friend RunQueue<awaiter>;
         simple_execution_context& ctx;
         awaiter* next = nullptr;
         std::coroutine_handle<> continuation;
-        
-        public:
-        explicit awaiter(simple_execution_context& ctx) noexcept : ctx(ctx) {}
-            bool await_ready() const noexcept { return false; }
-            void await_suspend(std::continuation_handle<> h) noexcept {
-                continuation = h;
-                ctx.enqueue(this);
-            }
-            void await_resume() noexcept {}};
-            class schedule_awaitable {
-                simple_execution_context& ctx;
-                public:
-                explicit schedule_awaitable(simple_execution_context& ctx) noexcept : ctx(ctx) {}
-                // Return an instance of the operation-state from'operator co_await()'
-                // This is will be placed as a local variable within the awaiting coroutine's
-                // coroutine-frame and means that we don't need a separate heap-allocation.
-                awaiter operator co_await() const noexcept { return awaiter{ctx};}
-            };
-            class scheduler {
-                simple_execution_context& ctx;
-                public:explicit scheduler(simple_execution_context& ctx) noexcept : ctx(ctx) {}
-                schedule_awaitable schedule() const noexcept { return schedule_awaitable{ctx}; }
-            };
-            public:scheduler get_scheduler() noexcept { return scheduler{*this}; }
-            // Processes all pending awaiters until the queue is empty.
-            void drain() noexcept {
-                while (head != nullptr) {
-                    awaiter* a = std::exchange(head, head->next);
-                    a->execute();
-                }
-            }
-            private:void enqueue(awaiter* a) noexcept {
-                a->next = std::exchange(head, a);
+        bool continueInline;
+        [[no_unique_address]] SchedStats::Stamp queued;
+
+    public:
+        explicit awaiter(simple_execution_context& ctx, bool continueInline = false) noexcept
+            : ctx(ctx), continueInline(continueInline) {}
+        bool await_ready() const noexcept { return continueInline && ctx.isCurrent(); }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept {
+            continuation = h;
+            // Once enqueued, this may be resumed and destroyed at any moment
+            simple_execution_context& c = ctx;
+            c.enqueue(this);
+            return c.nextToResume();
+        }
+        void await_resume() noexcept {}
+    };
+    class schedule_awaitable {
+        simple_execution_context& ctx;
+        bool continueInline;
+
+    public:
+        explicit schedule_awaitable(simple_execution_context& ctx, bool continueInline = false) noexcept
+            : ctx(ctx), continueInline(continueInline) {}
+        // Return an instance of the operation-state from'operator co_await()'
+        // This is will be placed as a local variable within the awaiting coroutine's
+        // coroutine-frame and means that we don't need a separate heap-allocation.
+        awaiter operator co_await() const noexcept { return awaiter{ctx, continueInline}; }
+    };
+    class scheduler {
+        simple_execution_context& ctx;
+
+    public:
+        explicit scheduler(simple_execution_context& ctx) noexcept : ctx(ctx) {}
+        schedule_awaitable schedule() const noexcept { return schedule_awaitable{ctx}; }
+        // Like schedule(), but completes inline, without queueing, when the
+        // awaiting coroutine already runs on a thread draining the context
+        schedule_awaitable schedule_or_continue() const noexcept { return schedule_awaitable{ctx, true}; }
+    };
+
+public:
+    scheduler get_scheduler() noexcept { return scheduler{*this}; }
+
+    // Processes all pending awaiters until the queue is empty.
+    void drain() noexcept {
+        current_scope scope{*this};
+        while (awaiter* a = queue.pop())
+            resume(a);
+    }
+
+    // Processes awaiters as they arrive, sleeping while there are none,
+    // until stop() is called.
+    void run() noexcept {
+        current_scope scope{*this};
+        while (!queue.stopped()) {
+            if (awaiter* a = queue.pop())
+                resume(a);
+            else
+                queue.park(workerSlot());
+        }
+    }
+
+    // Makes every run() return once it is done with its current awaiter.
+    // Whatever is still queued stays there for a later drain().
+    void stop() noexcept {
+        queue.stop();
+    }
+
+    // Counters of the context, see SchedStats.h. Each thread draining it
+    // counts in the Worker of its thread number modulo MaxWorkers, so only
+    // threads MaxWorkers apart share one. Awaiters resumed by symmetric
+    // transfer count as tasks, and as busy time of the awaiter that handed
+    // over. Empty unless built with SCHED_STATS.
+    SchedStats::Snapshot get_stats() const { return stats.snapshot(); }
+
+private:
+    // The context the calling thread is draining, if any
+    static inline thread_local simple_execution_context* current = nullptr;
+
+    struct current_scope {
+        simple_execution_context* previous;
+        explicit current_scope(simple_execution_context& ctx) noexcept
+            : previous(std::exchange(current, &ctx)) {}
+        ~current_scope() { current = previous; }
+    };
+
+    bool isCurrent() const noexcept { return current == this; }
+
+    static constexpr std::size_t MaxWorkers = 16;
+
+    // Numbers the threads in the order they first get here
+    static std::size_t workerSlot() noexcept {
+        static std::atomic<std::size_t> next{0};
+        thread_local const std::size_t slot = next.fetch_add(1, std::memory_order_relaxed) % MaxWorkers;
+        return slot;
+    }
+
+    void resume(awaiter* a) noexcept {
+        auto& worker = stats.worker(workerSlot());
+        const auto started = worker.started(a->queued);
+        a->continuation.resume();
+        worker.finished(started);
+    }
+
+    // Off the context, or stopping, the suspending coroutine returns to
+    // whoever resumed it; on it, the next awaiter is resumed straight away.
+    std::coroutine_handle<> nextToResume() noexcept {
+        if (isCurrent() && !queue.stopped())
+            if (awaiter* a = queue.pop()) {
+                stats.worker(workerSlot()).started(a->queued);
+                return a->continuation;
             }
-            awaiter* head = nullptr;
-};
\ No newline at end of file
+        return std::noop_coroutine();
+    }
+
+    void enqueue(awaiter* a) noexcept {
+        a->queued = stats.enqueued();
+        queue.push(a);
+    }
+
+    [[no_unique_address]] SchedStats::Stats stats{MaxWorkers};
+    RunQueue<awaiter> queue{&stats};
+};
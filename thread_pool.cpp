@@ -1,9 +1,17 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <condition_variable>
 #include <cstddef>
+#include <deque>
+#include <exception>
 #include <functional>
 #include <future>
-#include <queue>
+#include <latch>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <variant>
 #include <thread>
 #include <vector>
 #include <iostream>
@@ -11,15 +19,345 @@
 #include <sstream>
 #include <string>
 
+#include "SchedStats.h"
+#include "Topology.h"
+
+// Move-only nullary callable with inline storage. Callables that fit into
+// the buffer and are nothrow movable are stored in place, only larger ones
+// fall back to the heap.
+class Task final
+{
+public:
+
+    static constexpr std::size_t InlineSize = 6 * sizeof(void*);
+
+    Task() = default;
+
+    template<class F, class = std::enable_if_t<!std::is_same_v<std::decay_t<F>, Task>>>
+    Task(F&& f)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (fitsInline<Fn>())
+        {
+            ::new (static_cast<void*>(m_storage)) Fn(std::forward<F>(f));
+            m_ops = &inlineOps<Fn>;
+        }
+        else
+        {
+            ::new (static_cast<void*>(m_storage)) Fn*(new Fn(std::forward<F>(f)));
+            m_ops = &heapOps<Fn>;
+        }
+    }
+
+    Task(Task&& other) noexcept
+    {
+        moveFrom(other);
+    }
+
+    Task& operator=(Task&& other) noexcept
+    {
+        if (this != &other)
+        {
+            reset();
+            moveFrom(other);
+        }
+        return *this;
+    }
+
+    Task(Task const&) = delete;
+    Task& operator=(const Task&) = delete;
+
+    ~Task()
+    {
+        reset();
+    }
+
+    void operator()()
+    {
+        m_ops->invoke(m_storage);
+    }
+
+    explicit operator bool() const noexcept
+    {
+        return m_ops != nullptr;
+    }
+
+    void reset() noexcept
+    {
+        if (m_ops)
+        {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+private:
+
+    struct Ops
+    {
+        void (*invoke)(void*);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void*) noexcept;
+    };
+
+    template<class Fn>
+    static constexpr bool fitsInline()
+    {
+        return sizeof(Fn) <= InlineSize
+            && alignof(Fn) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible_v<Fn>;
+    }
+
+    template<class Fn>
+    static constexpr Ops inlineOps{
+        [] (void* p) { (*static_cast<Fn*>(p))(); },
+        [] (void* dst, void* src) noexcept
+        {
+            ::new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+            static_cast<Fn*>(src)->~Fn();
+        },
+        [] (void* p) noexcept { static_cast<Fn*>(p)->~Fn(); }
+    };
+
+    template<class Fn>
+    static constexpr Ops heapOps{
+        [] (void* p) { (**static_cast<Fn**>(p))(); },
+        [] (void* dst, void* src) noexcept { ::new (dst) Fn*(*static_cast<Fn**>(src)); },
+        [] (void* p) noexcept { delete *static_cast<Fn**>(p); }
+    };
+
+    void moveFrom(Task& other) noexcept
+    {
+        if (other.m_ops)
+        {
+            other.m_ops->move(m_storage, other.m_storage);
+            m_ops = std::exchange(other.m_ops, nullptr);
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char m_storage[InlineSize];
+    const Ops* m_ops = nullptr;
+};
+
+// Shared state of a TaskFuture. States are recycled through a per-thread
+// free list, so after warm-up submitting a task does not touch malloc.
+// There are exactly two references: the future and the running task.
+// Whichever lets go last puts the state on its own thread's free list;
+// that is usually the thread which called get(), i.e. the submitter.
+template<class T>
+class TaskState final
+{
+public:
+
+    using ValueT = std::conditional_t<std::is_void_v<T>, std::monostate, T>;
+
+    static TaskState* acquire()
+    {
+        auto& list = freeList();
+        TaskState* s = list.head;
+        if (s)
+        {
+            list.head = s->m_nextFree;
+            --list.size;
+        }
+        else
+            s = new TaskState;
+
+        s->m_refs.store(2, std::memory_order_relaxed);
+        s->m_ready.store(false, std::memory_order_relaxed);
+        return s;
+    }
+
+    void release() noexcept
+    {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) != 1)
+            return;
+
+        m_data.template emplace<0>();
+        auto& list = freeList();
+        if (list.size >= MaxFree)
+        {
+            delete this;
+            return;
+        }
+        m_nextFree = std::exchange(list.head, this);
+        ++list.size;
+    }
+
+    template<class... V>
+    void setValue(V&&... v)
+    {
+        m_data.template emplace<2>(std::forward<V>(v)...);
+        publish();
+    }
+
+    void setException(std::exception_ptr e)
+    {
+        m_data.template emplace<1>(std::move(e));
+        publish();
+    }
+
+    bool isReady() const noexcept
+    {
+        return m_ready.load(std::memory_order_acquire);
+    }
+
+    void wait() const noexcept
+    {
+        for (int i = 0; i < SpinCount && !isReady(); ++i)
+            std::this_thread::yield();
+        m_ready.wait(false, std::memory_order_acquire);
+    }
+
+    T get()
+    {
+        wait();
+        if (m_data.index() == 1)
+            std::rethrow_exception(std::get<1>(m_data));
+        if constexpr (!std::is_void_v<T>)
+            return std::move(std::get<2>(m_data));
+    }
+
+private:
+
+    static constexpr std::size_t MaxFree = 1024;
+    static constexpr int SpinCount = 64;
+
+    struct FreeList
+    {
+        TaskState* head = nullptr;
+        std::size_t size = 0;
+
+        ~FreeList()
+        {
+            while (head)
+                delete std::exchange(head, head->m_nextFree);
+        }
+    };
+
+    static FreeList& freeList()
+    {
+        static thread_local FreeList list;
+        return list;
+    }
+
+    void publish() noexcept
+    {
+        m_ready.store(true, std::memory_order_release);
+        m_ready.notify_all();
+    }
+
+    std::atomic<unsigned> m_refs{0};
+    std::atomic<bool> m_ready{false};
+    std::variant<std::monostate, std::exception_ptr, ValueT> m_data;
+    TaskState* m_nextFree = nullptr;
+};
+
+// The running task's reference to a TaskState. A task destroyed without
+// having run, as when the pool stops with tasks still queued, leaves the
+// future with broken_promise, just like a dropped std::promise.
+template<class T>
+class TaskStateRef final
+{
+public:
+
+    explicit TaskStateRef(TaskState<T>* state): m_state(state) {}
+
+    TaskStateRef(TaskStateRef&& other) noexcept: m_state(std::exchange(other.m_state, nullptr)) {}
+
+    TaskStateRef(TaskStateRef const&) = delete;
+    TaskStateRef& operator=(const TaskStateRef&) = delete;
+    TaskStateRef& operator=(TaskStateRef&&) = delete;
+
+    ~TaskStateRef()
+    {
+        if (m_state)
+        {
+            m_state->setException(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+            m_state->release();
+        }
+    }
+
+    TaskState<T>* operator->() const noexcept { return m_state; }
+
+    // The task has run and published its result
+    void release() noexcept
+    {
+        std::exchange(m_state, nullptr)->release();
+    }
+
+private:
+
+    TaskState<T>* m_state;
+};
+
+// Future returned by ThreadPool::submit(). Move-only, single get().
+template<class T>
+class TaskFuture final
+{
+public:
+
+    TaskFuture() = default;
+    explicit TaskFuture(TaskState<T>* state): m_state(state) {}
+
+    TaskFuture(TaskFuture&& other) noexcept: m_state(std::exchange(other.m_state, nullptr)) {}
+
+    TaskFuture& operator=(TaskFuture&& other) noexcept
+    {
+        if (this != &other)
+        {
+            if (m_state)
+                m_state->release();
+            m_state = std::exchange(other.m_state, nullptr);
+        }
+        return *this;
+    }
+
+    TaskFuture(TaskFuture const&) = delete;
+    TaskFuture& operator=(const TaskFuture&) = delete;
+
+    ~TaskFuture()
+    {
+        if (m_state)
+            m_state->release();
+    }
+
+    bool valid() const noexcept { return m_state != nullptr; }
+    bool is_ready() const noexcept { return m_state->isReady(); }
+    void wait() const noexcept { m_state->wait(); }
+
+    T get()
+    {
+        assert(m_state);
+        return m_state->get();
+    }
+
+private:
+
+    TaskState<T>* m_state = nullptr;
+};
+
 class ThreadPool final
 {
 public:
 
-    explicit ThreadPool(std::size_t nthreads = std::thread::hardware_concurrency()):
+    explicit ThreadPool(std::size_t nthreads = Topology::cpuCount()):
+        ThreadPool(Topology::Placement(nthreads))
+    {
+    }
+
+    // One worker per slot of the placement. Each worker is pinned before it
+    // allocates its deque, and steals on its own node before going further.
+    explicit ThreadPool(const Topology::Placement& placement):
         m_enabled(true),
-        m_pool(nthreads)
+        m_queues(placement.size()),
+        m_pool(placement.size()),
+        m_stats(m_pool.size()),
+        m_started(m_pool.size() + 1)
     {
-        run();
+        for (std::size_t i = 0; i < placement.size(); ++i)
+            m_victims.push_back(placement.victims(i));
+        run(placement);
     }
 
     ~ThreadPool()
@@ -34,29 +372,125 @@ public:
     auto enqueue(TaskT task) -> std::future<decltype(task())>
     {
         using ReturnT = decltype(task());
-        auto promise = std::make_shared<std::promise<ReturnT>>();
-        auto result = promise->get_future();
+        std::promise<ReturnT> promise;
+        auto result = promise.get_future();
+
+        // Task is move-only, so the promise is moved into the closure
+        // rather than shared.
+        auto t = [p = std::move(promise), t = std::move(task)] () mutable { execute(p, t); };
+
+        push(std::move(t));
+
+        return result;
+    }
 
-        auto t = [p = std::move(promise), t = std::move(task)] () mutable { execute(*p, t); };
+    // Like enqueue(), but the result travels through a recycled TaskState
+    // instead of std::promise/std::future. For a task whose captures fit
+    // into Task::InlineSize this is allocation-free once warmed up.
+    template<class TaskT>
+    auto submit(TaskT task) -> TaskFuture<decltype(task())>
+    {
+        using ReturnT = decltype(task());
+        auto state = TaskState<ReturnT>::acquire();
 
+        push([s = TaskStateRef<ReturnT>(state), t = std::move(task)] () mutable
         {
-            std::lock_guard<std::mutex> lock(m_mu);
-            m_tasks.push(std::move(t));
-        }
+            try
+            {
+                if constexpr (std::is_void_v<ReturnT>)
+                {
+                    t();
+                    s->setValue();
+                }
+                else
+                    s->setValue(t());
+            }
+            catch (...)
+            {
+                s->setException(std::current_exception());
+            }
+            s.release();
+        });
 
-        m_cv.notify_one();
+        return TaskFuture<ReturnT>(state);
+    }
 
-        return result;
+    // Fire-and-forget submission: no future, no shared state. An exception
+    // escaping the task terminates the program, as it would on a std::thread.
+    template<class TaskT>
+    void post(TaskT task)
+    {
+        push([t = std::move(task)] () mutable noexcept { t(); });
+    }
+
+    // Queue depth and per-worker counters, see SchedStats.h. Empty unless
+    // built with SCHED_STATS.
+    SchedStats::Snapshot stats() const
+    {
+        return m_stats.snapshot();
     }
 
 private:
 
+    struct Queued
+    {
+        Task task;
+        [[no_unique_address]] SchedStats::Stamp stamp;
+    };
+
+    // Task deque of one worker. The owner pushes and pops at the back (LIFO,
+    // the newest task is the one most likely to be hot in cache), idle
+    // workers steal from the front (FIFO, the oldest task). The lock is per
+    // worker, so it is only contended when somebody is stealing.
+    struct alignas(64) WorkQueue
+    {
+        std::mutex mu;
+        std::deque<Queued> tasks;
+
+        void push(Queued&& task)
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            tasks.push_back(std::move(task));
+        }
+
+        bool pop(Queued& task)
+        {
+            std::lock_guard<std::mutex> lock(mu);
+            if (tasks.empty())
+                return false;
+            task = std::move(tasks.back());
+            tasks.pop_back();
+            return true;
+        }
+
+        bool steal(Queued& task)
+        {
+            std::unique_lock<std::mutex> lock(mu, std::try_to_lock);
+            if (!lock || tasks.empty())
+                return false;
+            task = std::move(tasks.front());
+            tasks.pop_front();
+            return true;
+        }
+    };
+
+    // Only used to park idle workers, never on the submission fast path.
     std::mutex m_mu;
     std::condition_variable m_cv;
 
-    bool m_enabled;
+    std::atomic<bool> m_enabled;
+    std::atomic<std::size_t> m_pending{0};  // pushed but not yet taken by a worker
+    std::atomic<std::size_t> m_sleepers{0}; // workers parked on m_cv
+    std::atomic<std::size_t> m_next{0};     // round-robin slot for outside pushes
+    std::vector<std::unique_ptr<WorkQueue>> m_queues; // Allocated by their workers
     std::vector<std::thread> m_pool;
-    std::queue<std::function<void()>> m_tasks;
+    [[no_unique_address]] SchedStats::Stats m_stats;
+    std::vector<std::vector<std::size_t>> m_victims;  // Steal order of each worker
+    std::latch m_started;                             // Every queue is there
+
+    // Lets push() and the workers know which queue belongs to the calling thread.
+    static inline thread_local ThreadPool* t_owner = nullptr;
+    static inline thread_local std::size_t t_index = 0;
 
     template<class ResultT, class TaskT>
     static void execute(std::promise<ResultT>& p, TaskT& task)
@@ -71,6 +505,50 @@ private:
         p.set_value();
     }
 
+    // Tasks enqueued from a worker go to its own deque, tasks from outside
+    // the pool are spread over the workers round-robin.
+    void push(Task&& task)
+    {
+        const auto index = t_owner == this
+            ? t_index
+            : m_next.fetch_add(1, std::memory_order_relaxed) % m_queues.size();
+
+        m_queues[index]->push({std::move(task), m_stats.enqueued()});
+        m_pending.fetch_add(1);
+
+        if (m_sleepers.load() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mu);
+            m_cv.notify_one();
+            m_stats.wokeUp();
+        }
+    }
+
+    bool take(std::size_t index, Queued& task)
+    {
+        if (m_queues[index]->pop(task))
+            return true;
+
+        for (std::size_t victim : m_victims[index])
+            if (m_queues[victim]->steal(task))
+            {
+                m_stats.worker(index).stole();
+                return true;
+            }
+
+        return false;
+    }
+
+    void park(SchedStats::Worker& stats)
+    {
+        std::unique_lock<std::mutex> lock{ m_mu };
+        ++m_sleepers;
+        const auto parked = stats.parking();
+        m_cv.wait(lock, [&] () { return !m_enabled || m_pending.load() > 0; });
+        stats.unparked(parked);
+        --m_sleepers;
+    }
+
     void stop()
     {
         {
@@ -84,30 +562,37 @@ private:
             t.join();
     }
 
-    void run()
+    void run(const Topology::Placement& placement)
     {
-        auto f = [this] ()
+        auto f = [this] (std::size_t index, Topology::Slot slot)
         {
-            while (true)
+            slot.apply();
+            m_queues[index] = std::make_unique<WorkQueue>();
+            m_started.arrive_and_wait();
+            t_owner = this;
+            t_index = index;
+
+            auto& stats = m_stats.worker(index);
+            Queued task;
+            while (m_enabled)
             {
-                std::unique_lock<std::mutex> lock{ m_mu };
-                m_cv.wait(lock, [&] () { return !m_enabled || !m_tasks.empty(); });
-
-                if (!m_enabled)
-                    break;
-
-                assert(!m_tasks.empty());
-
-                auto task = std::move(m_tasks.front());
-                m_tasks.pop();
-
-                lock.unlock();
-                task();
+                if (!take(index, task))
+                {
+                    park(stats);
+                    continue;
+                }
+
+                m_pending.fetch_sub(1);
+                const auto started = stats.started(task.stamp);
+                task.task();
+                task.task.reset();
+                stats.finished(started);
             }
         };
 
-        for (auto& t : m_pool)
-            t = std::thread(f);
+        for (std::size_t i = 0; i < m_pool.size(); ++i)
+            m_pool[i] = std::thread(f, i, placement[i]);
+        m_started.arrive_and_wait();
     }
 };
 // Create some work to test the Thread Pool
@@ -148,6 +633,7 @@ struct Member
 int vv() { puts("nothing"); return 0; }
 int vs(const std::string& str) { puts(str.c_str()); return 0; }
 
+#ifndef NO_DEMO_MAIN
 int main()
 {
     ThreadPool threadPool{ std::thread::hardware_concurrency() };
@@ -192,5 +678,14 @@ int main()
     std::cout << f2.get() << '\n';
   //  std::cout << f3.get() << '\n';
 
+    threadPool.post(spitId);
+    auto f4 = threadPool.submit([i = 4]()
+    {
+        std::cout << "lambda " << i << '\n';
+        return i;
+    });
+    std::cout << f4.get() << '\n';
+
     return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
+#endif // NO_DEMO_MAIN